@@ -0,0 +1,228 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+//a routine parks in co_run_blocking,a pool thread runs the task and hands
+//it back to the routine's loop through that loop's wakeup eventfd.
+struct stCoBlockingLoop_t;
+struct stCoBlockingTask_t
+{
+	pfn_co_blocking_t pfn;
+	void *arg;
+	void *ret;
+	int iErrno;
+
+	stCoRoutine_t *co;
+	stCoBlockingLoop_t *loop;
+	stCoBlockingTask_t *pNext;
+	bool bDone; //set on the loop thread
+};
+struct stCoBlockingLoop_t
+{
+	stCoWakeup_t *wakeup;
+	pthread_mutex_t mutex;
+	stCoBlockingTask_t *head; //finished,waiting for the loop
+	stCoBlockingTask_t *tail;
+};
+struct stCoBlockingPool_t
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	stCoBlockingTask_t *head;
+	stCoBlockingTask_t *tail;
+	int iThreads;
+	int iIdle;
+	int iMaxThreads;
+};
+static stCoBlockingPool_t g_pool = { PTHREAD_MUTEX_INITIALIZER,PTHREAD_COND_INITIALIZER,NULL,NULL,0,0,4 };
+static __thread stCoBlockingLoop_t *t_blocking_loop = NULL;
+static bool g_blocking_hook = false;
+
+static void PushTask( stCoBlockingTask_t *&head,stCoBlockingTask_t *&tail,stCoBlockingTask_t *task )
+{
+	task->pNext = NULL;
+	if( tail )
+	{
+		tail->pNext = task;
+	}
+	else
+	{
+		head = task;
+	}
+	tail = task;
+}
+
+static void *BlockingWorker( void * )
+{
+	pthread_mutex_lock( &g_pool.mutex );
+	for(;;)
+	{
+		while( !g_pool.head )
+		{
+			g_pool.iIdle++;
+			pthread_cond_wait( &g_pool.cond,&g_pool.mutex );
+			g_pool.iIdle--;
+		}
+		stCoBlockingTask_t *task = g_pool.head;
+		g_pool.head = task->pNext;
+		if( !g_pool.head )
+		{
+			g_pool.tail = NULL;
+		}
+		pthread_mutex_unlock( &g_pool.mutex );
+
+		errno = 0;
+		task->ret = task->pfn( task->arg );
+		task->iErrno = errno;
+
+		stCoBlockingLoop_t *loop = task->loop;
+		pthread_mutex_lock( &loop->mutex );
+		bool wake = !loop->head; //one signal per batch
+		PushTask( loop->head,loop->tail,task );
+		pthread_mutex_unlock( &loop->mutex );
+		if( wake )
+		{
+			co_wakeup_signal( loop->wakeup );
+		}
+
+		pthread_mutex_lock( &g_pool.mutex );
+	}
+	return NULL;
+}
+
+//runs on the loop
+static void OnBlockingDone( void *arg )
+{
+	stCoBlockingLoop_t *loop = (stCoBlockingLoop_t*)arg;
+	pthread_mutex_lock( &loop->mutex );
+	stCoBlockingTask_t *task = loop->head;
+	loop->head = loop->tail = NULL;
+	pthread_mutex_unlock( &loop->mutex );
+
+	while( task )
+	{
+		stCoBlockingTask_t *next = task->pNext;
+		task->bDone = true;
+		co_resume( task->co );
+		task = next;
+	}
+}
+
+static stCoBlockingLoop_t *GetBlockingLoop()
+{
+	if( t_blocking_loop )
+	{
+		return t_blocking_loop;
+	}
+	stCoBlockingLoop_t *loop = (stCoBlockingLoop_t*)calloc( 1,sizeof(stCoBlockingLoop_t) );
+	loop->wakeup = co_wakeup_alloc( co_get_epoll_ct(),OnBlockingDone,loop );
+	if( !loop->wakeup )
+	{
+		free( loop );
+		return NULL;
+	}
+	pthread_mutex_init( &loop->mutex,NULL );
+	t_blocking_loop = loop;
+	return loop;
+}
+
+static int Submit( stCoBlockingTask_t *task )
+{
+	pthread_mutex_lock( &g_pool.mutex );
+	if( !g_pool.iIdle && g_pool.iThreads < g_pool.iMaxThreads )
+	{
+		pthread_t tid;
+		if( pthread_create( &tid,NULL,BlockingWorker,NULL ) == 0 )
+		{
+			pthread_detach( tid );
+			g_pool.iThreads++;
+		}
+		else if( !g_pool.iThreads )
+		{
+			pthread_mutex_unlock( &g_pool.mutex );
+			return -1;
+		}
+	}
+	PushTask( g_pool.head,g_pool.tail,task );
+	pthread_cond_signal( &g_pool.cond );
+	pthread_mutex_unlock( &g_pool.mutex );
+	return 0;
+}
+
+void *co_run_blocking( pfn_co_blocking_t pfn,void *arg )
+{
+	stCoRoutine_t *self = co_self();
+	stCoBlockingLoop_t *loop = ( self && !self->cIsMain ) ? GetBlockingLoop() : NULL;
+	if( !loop )
+	{
+		return pfn( arg );
+	}
+	//on the heap,a shared stack is swapped out while we park
+	stCoBlockingTask_t *task = (stCoBlockingTask_t*)calloc( 1,sizeof(stCoBlockingTask_t) );
+	task->pfn = pfn;
+	task->arg = arg;
+	task->co = self;
+	task->loop = loop;
+	if( Submit( task ) < 0 )
+	{
+		free( task );
+		return pfn( arg );
+	}
+
+	//not cancellable: the pool thread owns task until it comes back
+	self->cWaitReason = CO_WAIT_BLOCKING;
+	while( !task->bDone )
+	{
+		co_yield_env( co_get_curr_thread_env() );
+	}
+	self->cWaitReason = CO_WAIT_NONE;
+
+	void *ret = task->ret;
+	int err = task->iErrno;
+	free( task );
+	errno = err;
+	return ret;
+}
+
+int co_blocking_set_threads( int cnt )
+{
+	if( cnt <= 0 )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock( &g_pool.mutex );
+	g_pool.iMaxThreads = cnt;
+	pthread_mutex_unlock( &g_pool.mutex );
+	return 0;
+}
+
+void co_enable_blocking_hook( bool on )
+{
+	__atomic_store_n( &g_blocking_hook,on,__ATOMIC_RELAXED );
+}
+bool co_is_blocking_hook()
+{
+	return __atomic_load_n( &g_blocking_hook,__ATOMIC_RELAXED );
+}
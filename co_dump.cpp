@@ -0,0 +1,276 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+
+enum
+{
+	eMaxDumpFrames = 64,
+};
+
+static int g_dump_fd = -1;
+
+static void DumpWrite( int fd,const char *buf,int len )
+{
+	while( len > 0 )
+	{
+		ssize_t ret = write( fd,buf,len );
+		if( ret < 0 && errno == EINTR )
+		{
+			continue;
+		}
+		if( ret <= 0 )
+		{
+			return ;
+		}
+		buf += ret;
+		len -= ret;
+	}
+}
+
+//the stack image of a suspended routine:
+//[lo,hi) is where its frames live,mem is where they are now readable.
+//they differ for a copy-stack routine whose frames sit in save_buffer.
+struct stDumpStack_t
+{
+	char *lo;
+	char *hi;
+	char *mem;
+};
+
+static bool GetDumpStack( stCoRoutine_t *co,stDumpStack_t &s )
+{
+	if( co->cIsMain || !co->stack_mem )
+	{
+		return false;
+	}
+	s.lo = (char*)co->ctx.regs[ 13 ];
+	s.hi = co->stack_mem->stack_bp;
+	s.mem = s.lo;
+
+	if( co->cIsShareStack && co->stack_mem->occupy_co != co )
+	{
+		//swapped out: the image was copied from [stack_sp,stack_bp)
+		if( !co->save_buffer )
+		{
+			return false;
+		}
+		s.lo = co->stack_sp;
+		s.mem = co->save_buffer;
+		if( s.hi - s.lo != (long)co->save_size )
+		{
+			return false;
+		}
+	}
+	return s.lo < s.hi;
+}
+
+static bool ReadStackWord( const stDumpStack_t &s,char *addr,void **val )
+{
+	if( addr < s.lo || addr + sizeof(void*) > s.hi || ( (unsigned long)addr & ( sizeof(void*) - 1 ) ) )
+	{
+		return false;
+	}
+	memcpy( val,s.mem + ( addr - s.lo ),sizeof(void*) );
+	return true;
+}
+
+//walk the rbp chain saved by coctx_swap.
+//every read is bounded by the routine's own stack,so garbage in rbp
+//( -fomit-frame-pointer callers ) only shortens the trace.
+static int UnwindRoutine( stCoRoutine_t *co,void **frames,int size )
+{
+#if defined(__x86_64__)
+	int n = 0;
+	frames[ n++ ] = co->ctx.regs[ 9 ]; //ret func addr
+
+	stDumpStack_t s;
+	if( !GetDumpStack( co,s ) )
+	{
+		return n;
+	}
+	char *fp = (char*)co->ctx.regs[ 6 ];
+	while( n < size )
+	{
+		void *next = NULL;
+		void *ret = NULL;
+		if( !ReadStackWord( s,fp,&next ) || !ReadStackWord( s,fp + sizeof(void*),&ret ) )
+		{
+			break;
+		}
+		if( !ret )
+		{
+			break;
+		}
+		frames[ n++ ] = ret;
+		if( (char*)next <= fp )
+		{
+			break;
+		}
+		fp = (char*)next;
+	}
+	return n;
+#else
+	frames[ 0 ] = co->ctx.regs[ 0 ]; //ret func addr
+	return 1;
+#endif
+}
+
+static const char *GetWaitName( int reason )
+{
+	switch( reason )
+	{
+		case CO_WAIT_FD: return "fd";
+		case CO_WAIT_TIMER: return "timer";
+		case CO_WAIT_COND: return "cond";
+		case CO_WAIT_JOIN: return "join";
+		case CO_WAIT_BLOCKING: return "blocking";
+	}
+	return "none";
+}
+
+//snprintf returns what it would have written,keep room for the newline
+static int ClampLen( int len,int size )
+{
+	if( len < 0 )
+	{
+		return 0;
+	}
+	return len > size - 1 ? size - 1 : len;
+}
+static void DumpRoutine( stCoRoutineEnv_t *env,stCoRoutine_t *co,int fd )
+{
+	bool running = env->iCallStackSize > 0 && env->pCallStack[ env->iCallStackSize - 1 ] == co;
+	bool resuming = false;
+	for(int i=0;i<env->iCallStackSize - 1;i++)
+	{
+		if( env->pCallStack[i] == co )
+		{
+			resuming = true;
+			break;
+		}
+	}
+	const char *state = "suspended";
+	if( running )
+	{
+		state = "running";
+	}
+	else if( resuming )
+	{
+		state = "resuming"; //waiting in co_resume for a child to yield
+	}
+	else if( co->cEnd )
+	{
+		state = "ended";
+	}
+	else if( !co->cStart )
+	{
+		state = "created";
+	}
+
+	char buf[256];
+	int len = snprintf( buf,sizeof(buf),
+			"routine %llu co %p pfn %p arg %p %s%s%s wait %s",
+			co->ullId,co,(void*)co->pfn,co->arg,state,
+			co->cIsMain ? " main" : "",co->cIsShareStack ? " copystack" : "",
+			GetWaitName( co->cWaitReason ) );
+	len = ClampLen( len,sizeof(buf) );
+	if( co->cWaitReason == CO_WAIT_FD )
+	{
+		len += snprintf( buf + len,sizeof(buf) - len," fd %d",co->iWaitFd );
+		len = ClampLen( len,sizeof(buf) );
+	}
+	if( co->cCancel )
+	{
+		len += snprintf( buf + len,sizeof(buf) - len," cancelled" );
+		len = ClampLen( len,sizeof(buf) );
+	}
+	buf[ len++ ] = '\n';
+	DumpWrite( fd,buf,len );
+
+	void *frames[ eMaxDumpFrames ];
+	int n = 0;
+	if( running )
+	{
+		n = backtrace( frames,eMaxDumpFrames );
+	}
+	else if( co->cStart && !co->cEnd )
+	{
+		n = UnwindRoutine( co,frames,eMaxDumpFrames );
+	}
+	if( n > 0 )
+	{
+		backtrace_symbols_fd( frames,n,fd );
+	}
+}
+
+int co_dump_all( int fd )
+{
+	stCoRoutineEnv_t *env = co_get_curr_thread_env();
+	if( !env )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	int cnt = 0;
+	for(stCoRoutine_t *co = env->stLiveList.head;co;co = co->pNext)
+	{
+		DumpRoutine( env,co,fd );
+		cnt++;
+	}
+	char buf[64];
+	int len = snprintf( buf,sizeof(buf),"co_dump_all: %d routines\n",cnt );
+	DumpWrite( fd,buf,len );
+	return cnt;
+}
+
+static void OnDumpSignal( int )
+{
+	int saved = errno;
+	co_dump_all( g_dump_fd );
+	errno = saved;
+}
+
+int co_dump_on_signal( int signo,int fd )
+{
+	if( signo <= 0 || fd < 0 )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	g_dump_fd = fd;
+
+	//the first backtrace may malloc while loading the unwinder
+	void *frames[ 1 ];
+	backtrace( frames,1 );
+
+	struct sigaction sa;
+	memset( &sa,0,sizeof(sa) );
+	sa.sa_handler = OnDumpSignal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset( &sa.sa_mask );
+	return sigaction( signo,&sa,NULL );
+}
@@ -20,6 +20,11 @@
 #include <sys/time.h>
 #include <sys/syscall.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
 
 #include <dlfcn.h>
 #include <poll.h>
@@ -27,6 +32,7 @@
 #include <fcntl.h>
 
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <errno.h>
 #include <time.h>
 
@@ -45,6 +51,13 @@
 #include "co_routine.h"
 #include "co_routine_inner.h"
 #include "co_routine_specific.h"
+#include "co_probe.h"
+
+//hooked call spans for tracepoints and the timeline recorder
+#define HOOK_SYS_ENTRY( name,fd ) \
+	do { CO_PROBE2( sys_entry,name,fd ); CO_TRACE( CO_TRACE_SYS_ENTER,0,name,fd,0 ); } while(0)
+#define HOOK_SYS_EXIT( name,fd,ret ) \
+	do { CO_PROBE3( sys_exit,name,fd,ret ); CO_TRACE( CO_TRACE_SYS_EXIT,0,name,fd,(long)(ret) ); } while(0)
 
 typedef long long ll64_t;
 
@@ -85,12 +98,46 @@ typedef ssize_t (*recvfrom_pfn_t)(int socket, void *buffer, size_t length,
 typedef size_t (*send_pfn_t)(int socket, const void *buffer, size_t length, int flags);
 typedef ssize_t (*recv_pfn_t)(int socket, void *buffer, size_t length, int flags);
 
+typedef ssize_t (*readv_pfn_t)(int fildes, const struct iovec *iov, int iovcnt);
+typedef ssize_t (*writev_pfn_t)(int fildes, const struct iovec *iov, int iovcnt);
+typedef ssize_t (*recvmsg_pfn_t)(int socket, struct msghdr *message, int flags);
+typedef ssize_t (*sendmsg_pfn_t)(int socket, const struct msghdr *message, int flags);
+typedef int (*recvmmsg_pfn_t)(int socket, struct mmsghdr *vmessages, unsigned int vlen,
+					int flags, struct timespec *tmo);
+typedef int (*sendmmsg_pfn_t)(int socket, struct mmsghdr *vmessages, unsigned int vlen, int flags);
+
+typedef ssize_t (*sendfile_pfn_t)(int out_fd, int in_fd, off_t *offset, size_t count);
+typedef ssize_t (*splice_pfn_t)(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+					size_t len, unsigned int flags);
+typedef ssize_t (*tee_pfn_t)(int fd_in, int fd_out, size_t len, unsigned int flags);
+
+typedef int (*open_pfn_t)(const char *pathname, int flags, ...);
+typedef ssize_t (*pread_pfn_t)(int fd, void *buf, size_t count, off_t offset);
+typedef ssize_t (*pwrite_pfn_t)(int fd, const void *buf, size_t count, off_t offset);
+typedef int (*fsync_pfn_t)(int fd);
+typedef int (*stat_pfn_t)(const char *pathname, struct stat *statbuf);
+
+typedef int (*nanosleep_pfn_t)(const struct timespec *req, struct timespec *rem);
+typedef int (*clock_nanosleep_pfn_t)(clockid_t clockid, int flags,
+					const struct timespec *req, struct timespec *rem);
+typedef int (*usleep_pfn_t)(useconds_t usec);
+typedef unsigned int (*sleep_pfn_t)(unsigned int seconds);
+
+typedef int (*select_pfn_t)(int nfds, fd_set *readfds, fd_set *writefds,
+					fd_set *exceptfds, struct timeval *timeout);
+typedef int (*pselect_pfn_t)(int nfds, fd_set *readfds, fd_set *writefds,
+					fd_set *exceptfds, const struct timespec *timeout, const sigset_t *sigmask);
+typedef int (*ppoll_pfn_t)(struct pollfd *fds, nfds_t nfds,
+					const struct timespec *tmo_p, const sigset_t *sigmask);
+typedef int (*epoll_wait_pfn_t)(int epfd, struct epoll_event *events, int maxevents, int timeout);
+
 typedef int (*poll_pfn_t)(struct pollfd fds[], nfds_t nfds, int timeout);
 typedef int (*setsockopt_pfn_t)(int socket, int level, int option_name,
 			                 const void *option_value, socklen_t option_len);
 
 typedef int (*fcntl_pfn_t)(int fildes, int cmd, ...);
 typedef struct tm *(*localtime_r_pfn_t)( const time_t *timep, struct tm *result );
+typedef void (*tzset_pfn_t)();
 
 typedef void *(*pthread_getspecific_pfn_t)(pthread_key_t key);
 typedef int (*pthread_setspecific_pfn_t)(pthread_key_t key, const void *value);
@@ -100,6 +147,8 @@ typedef int (*unsetenv_pfn_t)(const char *name);
 typedef char *(*getenv_pfn_t)(const char *name);
 typedef hostent* (*gethostbyname_pfn_t)(const char *name);
 typedef res_state (*__res_state_pfn_t)();
+typedef int (*getaddrinfo_pfn_t)(const char *node, const char *service,
+					const struct addrinfo *hints, struct addrinfo **res);
 typedef int (*__poll_pfn_t)(struct pollfd fds[], nfds_t nfds, int timeout);
 
 static socket_pfn_t g_sys_socket_func 	= (socket_pfn_t)dlsym(RTLD_NEXT,"socket");
@@ -115,11 +164,40 @@ static recvfrom_pfn_t g_sys_recvfrom_func = (recvfrom_pfn_t)dlsym(RTLD_NEXT,"rec
 static send_pfn_t g_sys_send_func 		= (send_pfn_t)dlsym(RTLD_NEXT,"send");
 static recv_pfn_t g_sys_recv_func 		= (recv_pfn_t)dlsym(RTLD_NEXT,"recv");
 
+static readv_pfn_t g_sys_readv_func 	= (readv_pfn_t)dlsym(RTLD_NEXT,"readv");
+static writev_pfn_t g_sys_writev_func 	= (writev_pfn_t)dlsym(RTLD_NEXT,"writev");
+static recvmsg_pfn_t g_sys_recvmsg_func = (recvmsg_pfn_t)dlsym(RTLD_NEXT,"recvmsg");
+static sendmsg_pfn_t g_sys_sendmsg_func = (sendmsg_pfn_t)dlsym(RTLD_NEXT,"sendmsg");
+static recvmmsg_pfn_t g_sys_recvmmsg_func = (recvmmsg_pfn_t)dlsym(RTLD_NEXT,"recvmmsg");
+static sendmmsg_pfn_t g_sys_sendmmsg_func = (sendmmsg_pfn_t)dlsym(RTLD_NEXT,"sendmmsg");
+
+static sendfile_pfn_t g_sys_sendfile_func = (sendfile_pfn_t)dlsym(RTLD_NEXT,"sendfile");
+static splice_pfn_t g_sys_splice_func 	= (splice_pfn_t)dlsym(RTLD_NEXT,"splice");
+static tee_pfn_t g_sys_tee_func 		= (tee_pfn_t)dlsym(RTLD_NEXT,"tee");
+
+static open_pfn_t g_sys_open_func 		= (open_pfn_t)dlsym(RTLD_NEXT,"open");
+static pread_pfn_t g_sys_pread_func 	= (pread_pfn_t)dlsym(RTLD_NEXT,"pread");
+static pwrite_pfn_t g_sys_pwrite_func 	= (pwrite_pfn_t)dlsym(RTLD_NEXT,"pwrite");
+static fsync_pfn_t g_sys_fsync_func 	= (fsync_pfn_t)dlsym(RTLD_NEXT,"fsync");
+static stat_pfn_t g_sys_stat_func 		= (stat_pfn_t)dlsym(RTLD_NEXT,"stat");
+
+static nanosleep_pfn_t g_sys_nanosleep_func = (nanosleep_pfn_t)dlsym(RTLD_NEXT,"nanosleep");
+static clock_nanosleep_pfn_t g_sys_clock_nanosleep_func = (clock_nanosleep_pfn_t)dlsym(RTLD_NEXT,"clock_nanosleep");
+static usleep_pfn_t g_sys_usleep_func 	= (usleep_pfn_t)dlsym(RTLD_NEXT,"usleep");
+static sleep_pfn_t g_sys_sleep_func 	= (sleep_pfn_t)dlsym(RTLD_NEXT,"sleep");
+
+static select_pfn_t g_sys_select_func 	= (select_pfn_t)dlsym(RTLD_NEXT,"select");
+static pselect_pfn_t g_sys_pselect_func = (pselect_pfn_t)dlsym(RTLD_NEXT,"pselect");
+static ppoll_pfn_t g_sys_ppoll_func 	= (ppoll_pfn_t)dlsym(RTLD_NEXT,"ppoll");
+static epoll_wait_pfn_t g_sys_epoll_wait_func = (epoll_wait_pfn_t)dlsym(RTLD_NEXT,"epoll_wait");
+
 static poll_pfn_t g_sys_poll_func 		= (poll_pfn_t)dlsym(RTLD_NEXT,"poll");
 
 static setsockopt_pfn_t g_sys_setsockopt_func 
 										= (setsockopt_pfn_t)dlsym(RTLD_NEXT,"setsockopt");
 static fcntl_pfn_t g_sys_fcntl_func 	= (fcntl_pfn_t)dlsym(RTLD_NEXT,"fcntl");
+static localtime_r_pfn_t g_sys_localtime_r_func = (localtime_r_pfn_t)dlsym(RTLD_NEXT,"localtime_r");
+static tzset_pfn_t g_sys_tzset_func 	= (tzset_pfn_t)dlsym(RTLD_NEXT,"tzset");
 
 static setenv_pfn_t g_sys_setenv_func   = (setenv_pfn_t)dlsym(RTLD_NEXT,"setenv");
 static unsetenv_pfn_t g_sys_unsetenv_func = (unsetenv_pfn_t)dlsym(RTLD_NEXT,"unsetenv");
@@ -127,6 +205,7 @@ static getenv_pfn_t g_sys_getenv_func   =  (getenv_pfn_t)dlsym(RTLD_NEXT,"getenv
 static __res_state_pfn_t g_sys___res_state_func  = (__res_state_pfn_t)dlsym(RTLD_NEXT,"__res_state");
 
 static gethostbyname_pfn_t g_sys_gethostbyname_func = (gethostbyname_pfn_t)dlsym(RTLD_NEXT, "gethostbyname");
+static getaddrinfo_pfn_t g_sys_getaddrinfo_func = (getaddrinfo_pfn_t)dlsym(RTLD_NEXT, "getaddrinfo");
 
 static __poll_pfn_t g_sys___poll_func = (__poll_pfn_t)dlsym(RTLD_NEXT, "__poll");
 
@@ -204,6 +283,15 @@ rpchook_t * alloc_by_fd( int fd )
 	}
 	return NULL;
 }
+int co_hook_write_timeout( int fd )
+{
+	rpchook_t *lp = get_by_fd( fd );
+	if( !lp )
+	{
+		return -1;
+	}
+	return ( lp->write_timeout.tv_sec * 1000 ) + ( lp->write_timeout.tv_usec / 1000 );
+}
 static inline void free_by_fd( int fd )
 {
 	if( fd > -1 && fd < (int)sizeof(g_rpchook_socket_fd) / (int)sizeof(g_rpchook_socket_fd[0]) )
@@ -278,6 +366,7 @@ int connect(int fd, const struct sockaddr *address, socklen_t address_len)
 	{
 		return ret;
 	}
+	HOOK_SYS_ENTRY( "connect",fd );
 
 	//2.wait
 	int pollret = 0;
@@ -295,10 +384,16 @@ int connect(int fd, const struct sockaddr *address, socklen_t address_len)
 		{
 			break;
 		}
+		if( pollret < 0 && ECANCELED == errno )
+		{
+			HOOK_SYS_EXIT( "connect",fd,-1 );
+			return -1;
+		}
 	}
 	if( pf.revents & POLLOUT ) //connect succ
 	{
 		errno = 0;
+		HOOK_SYS_EXIT( "connect",fd,0 );
 		return 0;
 	}
 
@@ -314,6 +409,7 @@ int connect(int fd, const struct sockaddr *address, socklen_t address_len)
 	{
 		errno = ETIMEDOUT;
 	} 
+	HOOK_SYS_EXIT( "connect",fd,ret );
 	return ret;
 }
 
@@ -347,6 +443,7 @@ ssize_t read( int fd, void *buf, size_t nbyte )
 		ssize_t ret = g_sys_read_func( fd,buf,nbyte );
 		return ret;
 	}
+	HOOK_SYS_ENTRY( "read",fd );
 
     // ûtimeoutsocket fd, Ĭtimeout 1
     bool block_without_timeout = lp->read_timeout.tv_sec == -1;
@@ -359,7 +456,19 @@ ssize_t read( int fd, void *buf, size_t nbyte )
     int pollret = 0;
     do {
         pollret = poll(&pf, 1, timeout);
-    } while (pollret == 0 && block_without_timeout);
+    } while (pollret == 0 && block_without_timeout && co_deadline_remaining() != 0);
+
+	if( pollret < 0 && ECANCELED == errno )
+	{
+		HOOK_SYS_EXIT( "read",fd,-1 );
+		return -1;
+	}
+	if( pollret == 0 && co_deadline_remaining() == 0 )
+	{
+		errno = ETIMEDOUT;
+		HOOK_SYS_EXIT( "read",fd,-1 );
+		return -1;
+	}
 
 	ssize_t readret = g_sys_read_func(fd, (char*)buf, nbyte);
 
@@ -369,6 +478,7 @@ ssize_t read( int fd, void *buf, size_t nbyte )
 					fd,readret,errno,pollret,timeout);
 	}
 
+	HOOK_SYS_EXIT( "read",fd,readret );
 	return readret;
 	
 }
@@ -387,6 +497,7 @@ ssize_t write( int fd, const void *buf, size_t nbyte )
 		ssize_t ret = g_sys_write_func( fd,buf,nbyte );
 		return ret;
 	}
+	HOOK_SYS_ENTRY( "write",fd );
 	size_t wrotelen = 0;
 	int timeout = ( lp->write_timeout.tv_sec * 1000 ) 
 				+ ( lp->write_timeout.tv_usec / 1000 );
@@ -395,6 +506,7 @@ ssize_t write( int fd, const void *buf, size_t nbyte )
 
 	if (writeret == 0)
 	{
+		HOOK_SYS_EXIT( "write",fd,writeret );
 		return writeret;
 	}
 
@@ -408,7 +520,18 @@ ssize_t write( int fd, const void *buf, size_t nbyte )
 		struct pollfd pf = { 0 };
 		pf.fd = fd;
 		pf.events = ( POLLOUT | POLLERR | POLLHUP );
-		poll( &pf,1,timeout );
+		int pollret = poll( &pf,1,timeout );
+		if( pollret < 0 && ECANCELED == errno )
+		{
+			writeret = -1;
+			break;
+		}
+		if( pollret == 0 && co_deadline_remaining() == 0 )
+		{
+			errno = ETIMEDOUT;
+			writeret = -1;
+			break;
+		}
 
 		writeret = g_sys_write_func( fd,(const char*)buf + wrotelen,nbyte - wrotelen );
 		
@@ -420,8 +543,10 @@ ssize_t write( int fd, const void *buf, size_t nbyte )
 	}
 	if (writeret <= 0 && wrotelen == 0)
 	{
+		HOOK_SYS_EXIT( "write",fd,writeret );
 		return writeret;
 	}
+	HOOK_SYS_EXIT( "write",fd,wrotelen );
 	return wrotelen;
 }
 
@@ -447,6 +572,7 @@ ssize_t sendto(int socket, const void *message, size_t length,
 	{
 		return g_sys_sendto_func( socket,message,length,flags,dest_addr,dest_len );
 	}
+	HOOK_SYS_ENTRY( "sendto",socket );
 
 	ssize_t ret = g_sys_sendto_func( socket,message,length,flags,dest_addr,dest_len );
 	if( ret < 0 && EAGAIN == errno )
@@ -458,11 +584,23 @@ ssize_t sendto(int socket, const void *message, size_t length,
 		struct pollfd pf = { 0 };
 		pf.fd = socket;
 		pf.events = ( POLLOUT | POLLERR | POLLHUP );
-		poll( &pf,1,timeout );
+		int pollret = poll( &pf,1,timeout );
+		if( pollret < 0 && ECANCELED == errno )
+		{
+			HOOK_SYS_EXIT( "sendto",socket,-1 );
+			return -1;
+		}
+		if( pollret == 0 && co_deadline_remaining() == 0 )
+		{
+			errno = ETIMEDOUT;
+			HOOK_SYS_EXIT( "sendto",socket,-1 );
+			return -1;
+		}
 
 		ret = g_sys_sendto_func( socket,message,length,flags,dest_addr,dest_len );
 
 	}
+	HOOK_SYS_EXIT( "sendto",socket,ret );
 	return ret;
 }
 
@@ -481,6 +619,7 @@ ssize_t recvfrom(int socket, void *buffer, size_t length,
 	{
 		return g_sys_recvfrom_func( socket,buffer,length,flags,address,address_len );
 	}
+	HOOK_SYS_ENTRY( "recvfrom",socket );
 
     // ûtimeoutsocket fd, Ĭtimeout 1
     bool block_without_timeout = lp->read_timeout.tv_sec == -1;
@@ -493,9 +632,22 @@ ssize_t recvfrom(int socket, void *buffer, size_t length,
     int pollret = 0;
     do {
         pollret = poll(&pf, 1, timeout);
-    } while (pollret == 0 && block_without_timeout);
+    } while (pollret == 0 && block_without_timeout && co_deadline_remaining() != 0);
+
+	if( pollret < 0 && ECANCELED == errno )
+	{
+		HOOK_SYS_EXIT( "recvfrom",socket,-1 );
+		return -1;
+	}
+	if( pollret == 0 && co_deadline_remaining() == 0 )
+	{
+		errno = ETIMEDOUT;
+		HOOK_SYS_EXIT( "recvfrom",socket,-1 );
+		return -1;
+	}
 
 	ssize_t ret = g_sys_recvfrom_func( socket,buffer,length,flags,address,address_len );
+	HOOK_SYS_EXIT( "recvfrom",socket,ret );
 	return ret;
 }
 
@@ -513,6 +665,7 @@ ssize_t send(int socket, const void *buffer, size_t length, int flags)
 	{
 		return g_sys_send_func( socket,buffer,length,flags );
 	}
+	HOOK_SYS_ENTRY( "send",socket );
 	size_t wrotelen = 0;
 	int timeout = ( lp->write_timeout.tv_sec * 1000 ) 
 				+ ( lp->write_timeout.tv_usec / 1000 );
@@ -520,6 +673,7 @@ ssize_t send(int socket, const void *buffer, size_t length, int flags)
 	ssize_t writeret = g_sys_send_func( socket,buffer,length,flags );
 	if (writeret == 0)
 	{
+		HOOK_SYS_EXIT( "send",socket,writeret );
 		return writeret;
 	}
 
@@ -533,7 +687,18 @@ ssize_t send(int socket, const void *buffer, size_t length, int flags)
 		struct pollfd pf = { 0 };
 		pf.fd = socket;
 		pf.events = ( POLLOUT | POLLERR | POLLHUP );
-		poll( &pf,1,timeout );
+		int pollret = poll( &pf,1,timeout );
+		if( pollret < 0 && ECANCELED == errno )
+		{
+			writeret = -1;
+			break;
+		}
+		if( pollret == 0 && co_deadline_remaining() == 0 )
+		{
+			errno = ETIMEDOUT;
+			writeret = -1;
+			break;
+		}
 
 		writeret = g_sys_send_func( socket,(const char*)buffer + wrotelen,length - wrotelen,flags );
 		
@@ -545,8 +710,10 @@ ssize_t send(int socket, const void *buffer, size_t length, int flags)
 	}
 	if (writeret <= 0 && wrotelen == 0)
 	{
+		HOOK_SYS_EXIT( "send",socket,writeret );
 		return writeret;
 	}
+	HOOK_SYS_EXIT( "send",socket,wrotelen );
 	return wrotelen;
 }
 
@@ -564,6 +731,7 @@ ssize_t recv( int socket, void *buffer, size_t length, int flags )
 	{
 		return g_sys_recv_func( socket,buffer,length,flags );
 	}
+	HOOK_SYS_ENTRY( "recv",socket );
 
     // ûtimeoutsocket fd, Ĭtimeout 1
     bool block_without_timeout = lp->read_timeout.tv_sec == -1;
@@ -576,7 +744,19 @@ ssize_t recv( int socket, void *buffer, size_t length, int flags )
     int pollret = 0;
     do {
         pollret = poll(&pf, 1, timeout);
-    } while (pollret == 0 && block_without_timeout);
+    } while (pollret == 0 && block_without_timeout && co_deadline_remaining() != 0);
+
+	if( pollret < 0 && ECANCELED == errno )
+	{
+		HOOK_SYS_EXIT( "recv",socket,-1 );
+		return -1;
+	}
+	if( pollret == 0 && co_deadline_remaining() == 0 )
+	{
+		errno = ETIMEDOUT;
+		HOOK_SYS_EXIT( "recv",socket,-1 );
+		return -1;
+	}
 
 	ssize_t readret = g_sys_recv_func( socket,buffer,length,flags );
 
@@ -586,172 +766,1267 @@ ssize_t recv( int socket, void *buffer, size_t length, int flags )
 					socket,readret,errno,pollret,timeout);
 	}
 
+	HOOK_SYS_EXIT( "recv",socket,readret );
 	return readret;
 	
 }
 
-extern int co_poll_inner( stCoEpoll_t *ctx,struct pollfd fds[], nfds_t nfds, int timeout, poll_pfn_t pollfunc);
-
-int poll(struct pollfd fds[], nfds_t nfds, int timeout)
+//wait until fd is readable as read() does,0 if ready
+static int WaitReadable( rpchook_t *lp,int fd )
 {
-	HOOK_SYS_FUNC( poll );
+	bool block_without_timeout = lp->read_timeout.tv_sec == -1;
+	int timeout = block_without_timeout ? 1 : ( lp->read_timeout.tv_sec * 1000 ) + ( lp->read_timeout.tv_usec / 1000 );
 
-	if (!co_is_enable_sys_hook() || timeout == 0) {
-		return g_sys_poll_func(fds, nfds, timeout);
+	struct pollfd pf = { 0 };
+	pf.fd = fd;
+	pf.events = ( POLLIN | POLLERR | POLLHUP );
+
+	int pollret = 0;
+	do {
+		pollret = poll(&pf, 1, timeout);
+	} while (pollret == 0 && block_without_timeout && co_deadline_remaining() != 0);
+
+	if( pollret < 0 && ECANCELED == errno )
+	{
+		return -1;
 	}
-	pollfd *fds_merge = NULL;
-	nfds_t nfds_merge = 0;
-	std::map<int, int> m;  // fd --> idx
-	std::map<int, int>::iterator it;
-	if (nfds > 1) {
-		fds_merge = (pollfd *)malloc(sizeof(pollfd) * nfds);
-		for (size_t i = 0; i < nfds; i++) {
-			if ((it = m.find(fds[i].fd)) == m.end()) {
-				fds_merge[nfds_merge] = fds[i];
-				m[fds[i].fd] = nfds_merge;
-				nfds_merge++;
-			} else {
-				int j = it->second;
-				fds_merge[j].events |= fds[i].events;  // merge in j slot
-			}
-		}
+	if( pollret == 0 && co_deadline_remaining() == 0 )
+	{
+		errno = ETIMEDOUT;
+		return -1;
 	}
+	return 0;
+}
 
-	int ret = 0;
-	if (nfds_merge == nfds || nfds == 1) {
-		ret = co_poll_inner(co_get_epoll_ct(), fds, nfds, timeout, g_sys_poll_func);
-	} else {
-		ret = co_poll_inner(co_get_epoll_ct(), fds_merge, nfds_merge, timeout,
-				g_sys_poll_func);
-		if (ret > 0) {
-			for (size_t i = 0; i < nfds; i++) {
-				it = m.find(fds[i].fd);
-				if (it != m.end()) {
-					int j = it->second;
-					fds[i].revents = fds_merge[j].revents & fds[i].events;
-				}
-			}
-		}
+static size_t GetIovecLen( const struct iovec *iov,int iovcnt )
+{
+	size_t len = 0;
+	for(int i=0;i<iovcnt;i++)
+	{
+		len += iov[i].iov_len;
 	}
-	free(fds_merge);
-	return ret;
-
-
+	return len;
 }
-int setsockopt(int fd, int level, int option_name,
-			                 const void *option_value, socklen_t option_len)
+//skip n written bytes of a private iovec copy
+static void AdvanceIovec( struct iovec *&iov,int &iovcnt,size_t n )
 {
-	HOOK_SYS_FUNC( setsockopt );
+	while( iovcnt > 0 && n >= iov->iov_len )
+	{
+		n -= iov->iov_len;
+		iov++;
+		iovcnt--;
+	}
+	if( iovcnt > 0 )
+	{
+		iov->iov_base = (char*)iov->iov_base + n;
+		iov->iov_len -= n;
+	}
+}
+
+ssize_t readv( int fd, const struct iovec *iov, int iovcnt )
+{
+	HOOK_SYS_FUNC( readv );
 
 	if( !co_is_enable_sys_hook() )
 	{
-		return g_sys_setsockopt_func( fd,level,option_name,option_value,option_len );
+		return g_sys_readv_func( fd,iov,iovcnt );
 	}
 	rpchook_t *lp = get_by_fd( fd );
 
-	if( lp && SOL_SOCKET == level )
+	if( !lp || ( O_NONBLOCK & lp->user_flag ) )
 	{
-		struct timeval *val = (struct timeval*)option_value;
-		if( SO_RCVTIMEO == option_name  ) 
-		{
-			memcpy( &lp->read_timeout,val,sizeof(*val) );
-		}
-		else if( SO_SNDTIMEO == option_name )
-		{
-			memcpy( &lp->write_timeout,val,sizeof(*val) );
-		}
+		return g_sys_readv_func( fd,iov,iovcnt );
 	}
-	return g_sys_setsockopt_func( fd,level,option_name,option_value,option_len );
-}
+	HOOK_SYS_ENTRY( "readv",fd );
 
+	if( WaitReadable( lp,fd ) < 0 )
+	{
+		HOOK_SYS_EXIT( "readv",fd,-1 );
+		return -1;
+	}
+	ssize_t readret = g_sys_readv_func( fd,iov,iovcnt );
 
-int fcntl(int fildes, int cmd, ...)
+	HOOK_SYS_EXIT( "readv",fd,readret );
+	return readret;
+}
+
+ssize_t writev( int fd, const struct iovec *iov, int iovcnt )
 {
-	HOOK_SYS_FUNC( fcntl );
+	HOOK_SYS_FUNC( writev );
 
-	if( fildes < 0 )
+	if( !co_is_enable_sys_hook() )
 	{
-		return __LINE__;
+		return g_sys_writev_func( fd,iov,iovcnt );
 	}
+	rpchook_t *lp = get_by_fd( fd );
 
-	va_list arg_list;
-	va_start( arg_list,cmd );
+	if( !lp || ( O_NONBLOCK & lp->user_flag ) || iovcnt <= 0 )
+	{
+		return g_sys_writev_func( fd,iov,iovcnt );
+	}
+	HOOK_SYS_ENTRY( "writev",fd );
 
-	int ret = -1;
-	rpchook_t *lp = get_by_fd( fildes );
-	switch( cmd )
+	int timeout = ( lp->write_timeout.tv_sec * 1000 )
+				+ ( lp->write_timeout.tv_usec / 1000 );
+
+	ssize_t writeret = g_sys_writev_func( fd,iov,iovcnt );
+	if( writeret == 0 )
 	{
-		case F_DUPFD:
+		HOOK_SYS_EXIT( "writev",fd,writeret );
+		return writeret;
+	}
+	size_t nbyte = GetIovecLen( iov,iovcnt );
+	size_t wrotelen = writeret > 0 ? writeret : 0;
+
+	//continue on a copy,the caller's iovec is const
+	struct iovec local[ 8 ];
+	struct iovec *copy = NULL;
+	struct iovec *left = NULL;
+	int leftcnt = iovcnt;
+	if( wrotelen < nbyte )
+	{
+		copy = iovcnt <= (int)( sizeof(local) / sizeof(local[0]) ) ? local
+			: (struct iovec*)malloc( sizeof(struct iovec) * iovcnt );
+		if( !copy )
 		{
-			int param = va_arg(arg_list,int);
-			ret = g_sys_fcntl_func( fildes,cmd,param );
-			break;
+			//what went out so far is still a short write
+			errno = ENOMEM;
+			HOOK_SYS_EXIT( "writev",fd,wrotelen ? (ssize_t)wrotelen : -1 );
+			return wrotelen ? (ssize_t)wrotelen : -1;
 		}
-		case F_GETFD:
+		memcpy( copy,iov,sizeof(struct iovec) * iovcnt );
+		left = copy;
+		AdvanceIovec( left,leftcnt,wrotelen );
+	}
+	while( wrotelen < nbyte )
+	{
+		struct pollfd pf = { 0 };
+		pf.fd = fd;
+		pf.events = ( POLLOUT | POLLERR | POLLHUP );
+		int pollret = poll( &pf,1,timeout );
+		if( pollret < 0 && ECANCELED == errno )
 		{
-			ret = g_sys_fcntl_func( fildes,cmd );
+			writeret = -1;
 			break;
 		}
-		case F_SETFD:
+		if( pollret == 0 && co_deadline_remaining() == 0 )
 		{
-			int param = va_arg(arg_list,int);
-			ret = g_sys_fcntl_func( fildes,cmd,param );
+			errno = ETIMEDOUT;
+			writeret = -1;
 			break;
 		}
-		case F_GETFL:
+
+		writeret = g_sys_writev_func( fd,left,leftcnt );
+
+		if( writeret <= 0 )
 		{
-			ret = g_sys_fcntl_func( fildes,cmd );
 			break;
 		}
-		case F_SETFL:
+		wrotelen += writeret;
+		AdvanceIovec( left,leftcnt,writeret );
+	}
+	if( copy && copy != local )
+	{
+		free( copy );
+	}
+	if (writeret <= 0 && wrotelen == 0)
+	{
+		HOOK_SYS_EXIT( "writev",fd,writeret );
+		return writeret;
+	}
+	HOOK_SYS_EXIT( "writev",fd,wrotelen );
+	return wrotelen;
+}
+
+ssize_t recvmsg( int socket, struct msghdr *message, int flags )
+{
+	HOOK_SYS_FUNC( recvmsg );
+
+	if( !co_is_enable_sys_hook() )
+	{
+		return g_sys_recvmsg_func( socket,message,flags );
+	}
+	rpchook_t *lp = get_by_fd( socket );
+
+	if( !lp || ( O_NONBLOCK & lp->user_flag ) || ( flags & MSG_DONTWAIT ) )
+	{
+		return g_sys_recvmsg_func( socket,message,flags );
+	}
+	HOOK_SYS_ENTRY( "recvmsg",socket );
+
+	if( WaitReadable( lp,socket ) < 0 )
+	{
+		HOOK_SYS_EXIT( "recvmsg",socket,-1 );
+		return -1;
+	}
+	ssize_t readret = g_sys_recvmsg_func( socket,message,flags );
+
+	HOOK_SYS_EXIT( "recvmsg",socket,readret );
+	return readret;
+}
+
+ssize_t sendmsg( int socket, const struct msghdr *message, int flags )
+{
+	HOOK_SYS_FUNC( sendmsg );
+
+	if( !co_is_enable_sys_hook() )
+	{
+		return g_sys_sendmsg_func( socket,message,flags );
+	}
+	rpchook_t *lp = get_by_fd( socket );
+
+	if( !lp || ( O_NONBLOCK & lp->user_flag ) || ( flags & MSG_DONTWAIT ) )
+	{
+		return g_sys_sendmsg_func( socket,message,flags );
+	}
+	HOOK_SYS_ENTRY( "sendmsg",socket );
+
+	int timeout = ( lp->write_timeout.tv_sec * 1000 )
+				+ ( lp->write_timeout.tv_usec / 1000 );
+
+	ssize_t writeret = g_sys_sendmsg_func( socket,message,flags );
+	size_t nbyte = GetIovecLen( message->msg_iov,message->msg_iovlen );
+
+	if( writeret == 0 || ( writeret > 0 && (size_t)writeret >= nbyte ) )
+	{
+		HOOK_SYS_EXIT( "sendmsg",socket,writeret );
+		return writeret;
+	}
+
+	//a datagram goes out whole or not at all: retry once like sendto
+	int err = errno;
+	int type = SOCK_STREAM;
+	socklen_t typelen = sizeof(type);
+	getsockopt( socket,SOL_SOCKET,SO_TYPE,&type,&typelen );
+	errno = err;
+	if( type != SOCK_STREAM )
+	{
+		if( writeret < 0 && EAGAIN == errno )
 		{
-			int param = va_arg(arg_list,int);
-			int flag = param;
-			if( co_is_enable_sys_hook() && lp )
+			struct pollfd pf = { 0 };
+			pf.fd = socket;
+			pf.events = ( POLLOUT | POLLERR | POLLHUP );
+			int pollret = poll( &pf,1,timeout );
+			if( pollret < 0 && ECANCELED == errno )
 			{
-				flag |= O_NONBLOCK;
+				HOOK_SYS_EXIT( "sendmsg",socket,-1 );
+				return -1;
 			}
-			ret = g_sys_fcntl_func( fildes,cmd,flag );
-			if( 0 == ret && lp )
+			if( pollret == 0 && co_deadline_remaining() == 0 )
 			{
-				lp->user_flag = param;
+				errno = ETIMEDOUT;
+				HOOK_SYS_EXIT( "sendmsg",socket,-1 );
+				return -1;
 			}
-			break;
+			writeret = g_sys_sendmsg_func( socket,message,flags );
 		}
-		case F_GETOWN:
+		HOOK_SYS_EXIT( "sendmsg",socket,writeret );
+		return writeret;
+	}
+	size_t wrotelen = writeret > 0 ? writeret : 0;
+
+	//stream: continue with the rest of the iovec,ancillary data went with the first part
+	struct msghdr msg = *message;
+	struct iovec local[ 8 ];
+	struct iovec *copy = NULL;
+	int leftcnt = message->msg_iovlen;
+	if( wrotelen < nbyte )
+	{
+		copy = leftcnt <= (int)( sizeof(local) / sizeof(local[0]) ) ? local
+			: (struct iovec*)malloc( sizeof(struct iovec) * leftcnt );
+		if( !copy )
 		{
-			ret = g_sys_fcntl_func( fildes,cmd );
-			break;
+			errno = ENOMEM;
+			HOOK_SYS_EXIT( "sendmsg",socket,wrotelen ? (ssize_t)wrotelen : -1 );
+			return wrotelen ? (ssize_t)wrotelen : -1;
 		}
-		case F_SETOWN:
+		memcpy( copy,message->msg_iov,sizeof(struct iovec) * leftcnt );
+		msg.msg_iov = copy;
+		AdvanceIovec( msg.msg_iov,leftcnt,wrotelen );
+		msg.msg_iovlen = leftcnt;
+		if( wrotelen > 0 )
 		{
-			int param = va_arg(arg_list,int);
-			ret = g_sys_fcntl_func( fildes,cmd,param );
-			break;
+			msg.msg_control = NULL;
+			msg.msg_controllen = 0;
 		}
-		case F_GETLK:
+	}
+	while( wrotelen < nbyte )
+	{
+		struct pollfd pf = { 0 };
+		pf.fd = socket;
+		pf.events = ( POLLOUT | POLLERR | POLLHUP );
+		int pollret = poll( &pf,1,timeout );
+		if( pollret < 0 && ECANCELED == errno )
 		{
-			struct flock *param = va_arg(arg_list,struct flock *);
-			ret = g_sys_fcntl_func( fildes,cmd,param );
+			writeret = -1;
 			break;
 		}
-		case F_SETLK:
+		if( pollret == 0 && co_deadline_remaining() == 0 )
 		{
-			struct flock *param = va_arg(arg_list,struct flock *);
-			ret = g_sys_fcntl_func( fildes,cmd,param );
+			errno = ETIMEDOUT;
+			writeret = -1;
 			break;
 		}
-		case F_SETLKW:
+
+		writeret = g_sys_sendmsg_func( socket,&msg,flags );
+
+		if( writeret <= 0 )
 		{
-			struct flock *param = va_arg(arg_list,struct flock *);
-			ret = g_sys_fcntl_func( fildes,cmd,param );
 			break;
 		}
+		wrotelen += writeret;
+		AdvanceIovec( msg.msg_iov,leftcnt,writeret );
+		msg.msg_iovlen = leftcnt;
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
 	}
-
-	va_end( arg_list );
-
-	return ret;
+	if( copy && copy != local )
+	{
+		free( copy );
+	}
+	if (writeret <= 0 && wrotelen == 0)
+	{
+		HOOK_SYS_EXIT( "sendmsg",socket,writeret );
+		return writeret;
+	}
+	HOOK_SYS_EXIT( "sendmsg",socket,wrotelen );
+	return wrotelen;
+}
+
+//one wakeup returns whatever is queued,up to vlen
+int recvmmsg( int socket, struct mmsghdr *vmessages, unsigned int vlen, int flags, struct timespec *tmo )
+{
+	HOOK_SYS_FUNC( recvmmsg );
+
+	if( !co_is_enable_sys_hook() )
+	{
+		return g_sys_recvmmsg_func( socket,vmessages,vlen,flags,tmo );
+	}
+	rpchook_t *lp = get_by_fd( socket );
+
+	if( !lp || ( O_NONBLOCK & lp->user_flag ) || ( flags & MSG_DONTWAIT ) )
+	{
+		return g_sys_recvmmsg_func( socket,vmessages,vlen,flags,tmo );
+	}
+	HOOK_SYS_ENTRY( "recvmmsg",socket );
+
+	if( WaitReadable( lp,socket ) < 0 )
+	{
+		HOOK_SYS_EXIT( "recvmmsg",socket,-1 );
+		return -1;
+	}
+	int ret = g_sys_recvmmsg_func( socket,vmessages,vlen,flags,tmo );
+
+	HOOK_SYS_EXIT( "recvmmsg",socket,ret );
+	return ret;
+}
+
+//keep sending the rest of the batch while the socket buffer drains
+int sendmmsg( int socket, struct mmsghdr *vmessages, unsigned int vlen, int flags )
+{
+	HOOK_SYS_FUNC( sendmmsg );
+
+	if( !co_is_enable_sys_hook() )
+	{
+		return g_sys_sendmmsg_func( socket,vmessages,vlen,flags );
+	}
+	rpchook_t *lp = get_by_fd( socket );
+
+	if( !lp || ( O_NONBLOCK & lp->user_flag ) || ( flags & MSG_DONTWAIT ) )
+	{
+		return g_sys_sendmmsg_func( socket,vmessages,vlen,flags );
+	}
+	HOOK_SYS_ENTRY( "sendmmsg",socket );
+
+	int timeout = ( lp->write_timeout.tv_sec * 1000 )
+				+ ( lp->write_timeout.tv_usec / 1000 );
+
+	unsigned int sent = 0;
+	int ret = g_sys_sendmmsg_func( socket,vmessages,vlen,flags );
+	if( ret > 0 )
+	{
+		sent += ret;
+	}
+	while( sent < vlen && ( ret > 0 || EAGAIN == errno ) )
+	{
+		struct pollfd pf = { 0 };
+		pf.fd = socket;
+		pf.events = ( POLLOUT | POLLERR | POLLHUP );
+		int pollret = poll( &pf,1,timeout );
+		if( pollret < 0 && ECANCELED == errno )
+		{
+			ret = -1;
+			break;
+		}
+		if( pollret == 0 && co_deadline_remaining() == 0 )
+		{
+			errno = ETIMEDOUT;
+			ret = -1;
+			break;
+		}
+		ret = g_sys_sendmmsg_func( socket,vmessages + sent,vlen - sent,flags );
+		if( ret <= 0 )
+		{
+			break;
+		}
+		sent += ret;
+	}
+	if( sent == 0 )
+	{
+		HOOK_SYS_EXIT( "sendmmsg",socket,ret );
+		return ret;
+	}
+	HOOK_SYS_EXIT( "sendmmsg",socket,sent );
+	return sent;
+}
+
+//a hooked fd the user left blocking
+static rpchook_t *GetBlockingHook( int fd )
+{
+	rpchook_t *lp = get_by_fd( fd );
+	if( !lp || ( O_NONBLOCK & lp->user_flag ) )
+	{
+		return NULL;
+	}
+	return lp;
+}
+static int WaitWritable( rpchook_t *lp,int fd )
+{
+	int timeout = ( lp->write_timeout.tv_sec * 1000 )
+				+ ( lp->write_timeout.tv_usec / 1000 );
+
+	struct pollfd pf = { 0 };
+	pf.fd = fd;
+	pf.events = ( POLLOUT | POLLERR | POLLHUP );
+	int pollret = poll( &pf,1,timeout );
+	if( pollret < 0 && ECANCELED == errno )
+	{
+		return -1;
+	}
+	if( pollret == 0 && co_deadline_remaining() == 0 )
+	{
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	return 0;
+}
+
+//continue from the updated offset until count bytes are out,eof or the write timeout
+ssize_t sendfile( int out_fd, int in_fd, off_t *offset, size_t count )
+{
+	HOOK_SYS_FUNC( sendfile );
+
+	if( !co_is_enable_sys_hook() )
+	{
+		return g_sys_sendfile_func( out_fd,in_fd,offset,count );
+	}
+	rpchook_t *lp = GetBlockingHook( out_fd );
+	if( !lp )
+	{
+		return g_sys_sendfile_func( out_fd,in_fd,offset,count );
+	}
+	HOOK_SYS_ENTRY( "sendfile",out_fd );
+
+	size_t sent = 0;
+	ssize_t ret = g_sys_sendfile_func( out_fd,in_fd,offset,count );
+	if( ret > 0 )
+	{
+		sent += ret;
+	}
+	while( sent < count && ret != 0 && ( ret > 0 || EAGAIN == errno ) )
+	{
+		if( WaitWritable( lp,out_fd ) < 0 )
+		{
+			ret = -1;
+			break;
+		}
+		ret = g_sys_sendfile_func( out_fd,in_fd,offset,count - sent );
+		if( ret <= 0 )
+		{
+			break;
+		}
+		sent += ret;
+	}
+	if( sent == 0 )
+	{
+		HOOK_SYS_EXIT( "sendfile",out_fd,ret );
+		return ret;
+	}
+	HOOK_SYS_EXIT( "sendfile",out_fd,sent );
+	return sent;
+}
+
+//into a blocking hooked socket: move all of len like write.
+//out of one: wait for data like read.
+ssize_t splice( int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags )
+{
+	HOOK_SYS_FUNC( splice );
+
+	if( !co_is_enable_sys_hook() || ( flags & SPLICE_F_NONBLOCK ) )
+	{
+		return g_sys_splice_func( fd_in,off_in,fd_out,off_out,len,flags );
+	}
+	rpchook_t *out = GetBlockingHook( fd_out );
+	rpchook_t *in = out ? NULL : GetBlockingHook( fd_in );
+	if( !out && !in )
+	{
+		return g_sys_splice_func( fd_in,off_in,fd_out,off_out,len,flags );
+	}
+	if( in )
+	{
+		HOOK_SYS_ENTRY( "splice",fd_in );
+		if( WaitReadable( in,fd_in ) < 0 )
+		{
+			HOOK_SYS_EXIT( "splice",fd_in,-1 );
+			return -1;
+		}
+		ssize_t ret = g_sys_splice_func( fd_in,off_in,fd_out,off_out,len,flags );
+		HOOK_SYS_EXIT( "splice",fd_in,ret );
+		return ret;
+	}
+	HOOK_SYS_ENTRY( "splice",fd_out );
+
+	size_t sent = 0;
+	ssize_t ret = g_sys_splice_func( fd_in,off_in,fd_out,off_out,len,flags );
+	if( ret > 0 )
+	{
+		sent += ret;
+	}
+	while( sent < len && ret != 0 && ( ret > 0 || EAGAIN == errno ) )
+	{
+		if( WaitWritable( out,fd_out ) < 0 )
+		{
+			ret = -1;
+			break;
+		}
+		ret = g_sys_splice_func( fd_in,off_in,fd_out,off_out,len - sent,flags );
+		if( ret <= 0 )
+		{
+			break;
+		}
+		sent += ret;
+	}
+	if( sent == 0 )
+	{
+		HOOK_SYS_EXIT( "splice",fd_out,ret );
+		return ret;
+	}
+	HOOK_SYS_EXIT( "splice",fd_out,sent );
+	return sent;
+}
+
+//pipes only: wait on whichever end libco knows,then one call
+ssize_t tee( int fd_in, int fd_out, size_t len, unsigned int flags )
+{
+	HOOK_SYS_FUNC( tee );
+
+	if( !co_is_enable_sys_hook() || ( flags & SPLICE_F_NONBLOCK ) )
+	{
+		return g_sys_tee_func( fd_in,fd_out,len,flags );
+	}
+	rpchook_t *out = GetBlockingHook( fd_out );
+	rpchook_t *in = GetBlockingHook( fd_in );
+	if( !out && !in )
+	{
+		return g_sys_tee_func( fd_in,fd_out,len,flags );
+	}
+	HOOK_SYS_ENTRY( "tee",fd_in );
+
+	if( in && WaitReadable( in,fd_in ) < 0 )
+	{
+		HOOK_SYS_EXIT( "tee",fd_in,-1 );
+		return -1;
+	}
+	ssize_t ret = g_sys_tee_func( fd_in,fd_out,len,flags );
+	if( ret < 0 && EAGAIN == errno && out )
+	{
+		if( WaitWritable( out,fd_out ) < 0 )
+		{
+			HOOK_SYS_EXIT( "tee",fd_in,-1 );
+			return -1;
+		}
+		ret = g_sys_tee_func( fd_in,fd_out,len,flags );
+	}
+	HOOK_SYS_EXIT( "tee",fd_in,ret );
+	return ret;
+}
+
+static int WaitSocketOut( int fd,int timeout_ms )
+{
+	struct pollfd pf = { 0 };
+	pf.fd = fd;
+	pf.events = ( POLLOUT | POLLERR | POLLHUP );
+	return co_poll( co_get_epoll_ct(),&pf,1,timeout_ms );
+}
+//file -> pipe -> socket,for files sendfile refuses
+static ssize_t SpliceFileRange( int sock,int file_fd,off_t offset,size_t count,int timeout_ms )
+{
+	int pipefd[2];
+	if( pipe( pipefd ) < 0 )
+	{
+		return -1;
+	}
+	size_t sent = 0;
+	loff_t off = offset;
+	while( sent < count )
+	{
+		size_t chunk = count - sent < 65536 ? count - sent : 65536;
+		ssize_t n = g_sys_splice_func( file_fd,&off,pipefd[1],NULL,chunk,SPLICE_F_MOVE );
+		if( n < 0 )
+		{
+			int err = errno;
+			g_sys_close_func( pipefd[0] );
+			g_sys_close_func( pipefd[1] );
+			errno = err;
+			return sent ? (ssize_t)sent : -1;
+		}
+		if( n == 0 )
+		{
+			break; //file is shorter than the range
+		}
+		while( n > 0 )
+		{
+			ssize_t ret = g_sys_splice_func( pipefd[0],NULL,sock,NULL,n,SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+			if( ret > 0 )
+			{
+				n -= ret;
+				sent += ret;
+				continue;
+			}
+			if( ret < 0 && EAGAIN == errno && WaitSocketOut( sock,timeout_ms ) > 0 )
+			{
+				continue;
+			}
+			g_sys_close_func( pipefd[0] );
+			g_sys_close_func( pipefd[1] );
+			return sent ? (ssize_t)sent : -1;
+		}
+	}
+	g_sys_close_func( pipefd[0] );
+	g_sys_close_func( pipefd[1] );
+	return sent;
+}
+
+ssize_t co_sendfile_range( int sock,int file_fd,off_t offset,size_t count,int timeout_ms )
+{
+	HOOK_SYS_FUNC( sendfile );
+	HOOK_SYS_FUNC( splice );
+
+	size_t sent = 0;
+	while( sent < count )
+	{
+		ssize_t ret = g_sys_sendfile_func( sock,file_fd,&offset,count - sent );
+		if( ret > 0 )
+		{
+			sent += ret;
+			continue;
+		}
+		if( ret == 0 )
+		{
+			break; //file is shorter than the range,0 for an offset at eof
+		}
+		if( EAGAIN == errno )
+		{
+			int pollret = WaitSocketOut( sock,timeout_ms );
+			if( pollret > 0 )
+			{
+				continue;
+			}
+			if( pollret == 0 )
+			{
+				errno = ETIMEDOUT;
+			}
+			return sent ? (ssize_t)sent : -1;
+		}
+		if( ( EINVAL == errno || ENOSYS == errno ) && sent == 0 )
+		{
+			return SpliceFileRange( sock,file_fd,offset,count,timeout_ms );
+		}
+		return sent ? (ssize_t)sent : -1;
+	}
+	return sent;
+}
+
+//file syscalls when co_enable_blocking_hook is on: pread/pwrite/fsync go
+//through co_pread & co ( io_uring or the pool ),open/stat to co_run_blocking
+struct stBlockingCall_t
+{
+	int iType;
+	const char *path;
+	int flags;
+	mode_t mode;
+	int fd;
+	struct stat *st;
+	ssize_t ret;
+};
+enum
+{
+	eCallOpen = 1,
+	eCallStat,
+};
+static void *BlockingCall( void *arg )
+{
+	stBlockingCall_t *c = (stBlockingCall_t*)arg;
+	switch( c->iType )
+	{
+		case eCallOpen: c->ret = g_sys_open_func( c->path,c->flags,c->mode ); break;
+		case eCallStat: c->ret = g_sys_stat_func( c->path,c->st ); break;
+	}
+	return NULL;
+}
+static bool ShouldOffload( int fd )
+{
+	//sockets have their own waits
+	return co_is_blocking_hook() && co_is_enable_sys_hook() && ( fd < 0 || !get_by_fd( fd ) );
+}
+static ssize_t OffloadCall( const char *name,stBlockingCall_t *c )
+{
+	HOOK_SYS_ENTRY( name,c->fd );
+	if( !GetCurrThreadCo()->cIsShareStack )
+	{
+		co_run_blocking( BlockingCall,c );
+		HOOK_SYS_EXIT( name,c->fd,c->ret );
+		return c->ret;
+	}
+	//a shared stack is swapped out while we park,the pool thread may only
+	//touch the heap: bounce the call,its path and the stat result
+	size_t plen = c->path ? strlen( c->path ) + 1 : 0;
+	stBlockingCall_t *h = (stBlockingCall_t*)malloc( sizeof(stBlockingCall_t) + sizeof(struct stat) + plen );
+	if( !h )
+	{
+		errno = ENOMEM;
+		HOOK_SYS_EXIT( name,c->fd,-1 );
+		return -1;
+	}
+	*h = *c;
+	h->st = (struct stat*)( h + 1 );
+	if( c->path )
+	{
+		char *path = (char*)( h->st + 1 );
+		memcpy( path,c->path,plen );
+		h->path = path;
+	}
+	co_run_blocking( BlockingCall,h );
+	int err = errno;
+	if( c->iType == eCallStat && h->ret == 0 )
+	{
+		memcpy( c->st,h->st,sizeof(struct stat) );
+	}
+	c->ret = h->ret;
+	free( h );
+	errno = err;
+	HOOK_SYS_EXIT( name,c->fd,c->ret );
+	return c->ret;
+}
+
+int open( const char *pathname, int flags, ... )
+{
+	HOOK_SYS_FUNC( open );
+
+	mode_t mode = 0;
+	//glibc's __OPEN_NEEDS_MODE: O_TMPFILE includes O_DIRECTORY
+	if( ( flags & O_CREAT ) || ( flags & O_TMPFILE ) == O_TMPFILE )
+	{
+		va_list args;
+		va_start( args,flags );
+		mode = va_arg( args,mode_t );
+		va_end( args );
+	}
+	if( !ShouldOffload( -1 ) )
+	{
+		return g_sys_open_func( pathname,flags,mode );
+	}
+	stBlockingCall_t c = { 0 };
+	c.iType = eCallOpen;
+	c.path = pathname;
+	c.flags = flags;
+	c.mode = mode;
+	c.fd = -1;
+	return OffloadCall( "open",&c );
+}
+ssize_t pread( int fd, void *buf, size_t count, off_t offset )
+{
+	HOOK_SYS_FUNC( pread );
+
+	if( !ShouldOffload( fd ) )
+	{
+		return g_sys_pread_func( fd,buf,count,offset );
+	}
+	HOOK_SYS_ENTRY( "pread",fd );
+	ssize_t ret = co_pread( fd,buf,count,offset );
+	HOOK_SYS_EXIT( "pread",fd,ret );
+	return ret;
+}
+ssize_t pwrite( int fd, const void *buf, size_t count, off_t offset )
+{
+	HOOK_SYS_FUNC( pwrite );
+
+	if( !ShouldOffload( fd ) )
+	{
+		return g_sys_pwrite_func( fd,buf,count,offset );
+	}
+	HOOK_SYS_ENTRY( "pwrite",fd );
+	ssize_t ret = co_pwrite( fd,buf,count,offset );
+	HOOK_SYS_EXIT( "pwrite",fd,ret );
+	return ret;
+}
+int fsync( int fd )
+{
+	HOOK_SYS_FUNC( fsync );
+
+	if( !ShouldOffload( fd ) )
+	{
+		return g_sys_fsync_func( fd );
+	}
+	HOOK_SYS_ENTRY( "fsync",fd );
+	int ret = co_fsync( fd );
+	HOOK_SYS_EXIT( "fsync",fd,ret );
+	return ret;
+}
+int stat( const char *pathname, struct stat *statbuf )
+{
+	HOOK_SYS_FUNC( stat );
+
+	if( !ShouldOffload( -1 ) )
+	{
+		return g_sys_stat_func( pathname,statbuf );
+	}
+	stBlockingCall_t c = { 0 };
+	c.iType = eCallStat;
+	c.path = pathname;
+	c.st = statbuf;
+	c.fd = -1;
+	return OffloadCall( "stat",&c );
+}
+
+extern int co_poll_inner( stCoEpoll_t *ctx,struct pollfd fds[], nfds_t nfds, int timeout, poll_pfn_t pollfunc);
+
+int poll(struct pollfd fds[], nfds_t nfds, int timeout)
+{
+	HOOK_SYS_FUNC( poll );
+
+	if (!co_is_enable_sys_hook() || timeout == 0) {
+		return g_sys_poll_func(fds, nfds, timeout);
+	}
+	pollfd *fds_merge = NULL;
+	nfds_t nfds_merge = 0;
+	std::map<int, int> m;  // fd --> idx
+	std::map<int, int>::iterator it;
+	if (nfds > 1) {
+		fds_merge = (pollfd *)malloc(sizeof(pollfd) * nfds);
+		for (size_t i = 0; i < nfds; i++) {
+			if ((it = m.find(fds[i].fd)) == m.end()) {
+				fds_merge[nfds_merge] = fds[i];
+				m[fds[i].fd] = nfds_merge;
+				nfds_merge++;
+			} else {
+				int j = it->second;
+				fds_merge[j].events |= fds[i].events;  // merge in j slot
+			}
+		}
+	}
+
+	int ret = 0;
+	if (nfds_merge == nfds || nfds == 1) {
+		ret = co_poll_inner(co_get_epoll_ct(), fds, nfds, timeout, g_sys_poll_func);
+	} else {
+		ret = co_poll_inner(co_get_epoll_ct(), fds_merge, nfds_merge, timeout,
+				g_sys_poll_func);
+		if (ret > 0) {
+			for (size_t i = 0; i < nfds; i++) {
+				it = m.find(fds[i].fd);
+				if (it != m.end()) {
+					int j = it->second;
+					fds[i].revents = fds_merge[j].revents & fds[i].events;
+				}
+			}
+		}
+	}
+	free(fds_merge);
+	return ret;
+
+
+}
+
+//sleep family: a timer wait on the loop,rounded up to the 1ms tick.
+//cut short by co_cancel or the routine deadline,like a signal would: -1 EINTR,rem set
+static long long GetSleepNs( clockid_t clk )
+{
+	struct timespec ts;
+	clock_gettime( clk,&ts );
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+static int CoSleep( long long ns,struct timespec *rem )
+{
+	HOOK_SYS_ENTRY( "sleep",-1 );
+
+	long long end = GetSleepNs( CLOCK_MONOTONIC ) + ns;
+	long long left = ns;
+	while( left > 0 )
+	{
+		long long ms = ( left + 999999 ) / 1000000;
+		int ret = co_poll_inner( co_get_epoll_ct(),NULL,0,ms > INT_MAX ? INT_MAX : (int)ms,g_sys_poll_func );
+
+		left = end - GetSleepNs( CLOCK_MONOTONIC );
+		if( left > 0 && ( ret < 0 || co_deadline_remaining() == 0 ) )
+		{
+			if( rem )
+			{
+				rem->tv_sec = left / 1000000000LL;
+				rem->tv_nsec = left % 1000000000LL;
+			}
+			HOOK_SYS_EXIT( "sleep",-1,-1 );
+			errno = EINTR;
+			return -1;
+		}
+	}
+	HOOK_SYS_EXIT( "sleep",-1,0 );
+	return 0;
+}
+static bool IsValidSleep( const struct timespec *req )
+{
+	return req && req->tv_nsec >= 0 && req->tv_nsec < 1000000000L && req->tv_sec >= 0;
+}
+
+int nanosleep( const struct timespec *req, struct timespec *rem )
+{
+	HOOK_SYS_FUNC( nanosleep );
+
+	if( !co_is_enable_sys_hook() || !IsValidSleep( req ) )
+	{
+		return g_sys_nanosleep_func( req,rem );
+	}
+	return CoSleep( req->tv_sec * 1000000000LL + req->tv_nsec,rem );
+}
+int clock_nanosleep( clockid_t clockid, int flags, const struct timespec *req, struct timespec *rem )
+{
+	HOOK_SYS_FUNC( clock_nanosleep );
+
+	//cpu time clocks do not pass while we are parked
+	if( !co_is_enable_sys_hook() || !IsValidSleep( req )
+		|| ( clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC && clockid != CLOCK_BOOTTIME ) )
+	{
+		return g_sys_clock_nanosleep_func( clockid,flags,req,rem );
+	}
+	long long ns = req->tv_sec * 1000000000LL + req->tv_nsec;
+	if( flags & TIMER_ABSTIME )
+	{
+		ns -= GetSleepNs( clockid );
+		rem = NULL; //not written for absolute sleeps
+	}
+	if( ns > 0 && CoSleep( ns,rem ) < 0 )
+	{
+		return errno; //error number,not errno
+	}
+	return 0;
+}
+int usleep( useconds_t usec )
+{
+	HOOK_SYS_FUNC( usleep );
+
+	if( !co_is_enable_sys_hook() )
+	{
+		return g_sys_usleep_func( usec );
+	}
+	return CoSleep( usec * 1000LL,NULL );
+}
+unsigned int sleep( unsigned int seconds )
+{
+	HOOK_SYS_FUNC( sleep );
+
+	if( !co_is_enable_sys_hook() )
+	{
+		return g_sys_sleep_func( seconds );
+	}
+	struct timespec rem = { 0 };
+	if( CoSleep( seconds * 1000000000LL,&rem ) < 0 )
+	{
+		return rem.tv_sec + ( rem.tv_nsec ? 1 : 0 );
+	}
+	return 0;
+}
+
+//select family: fd sets become a hooked poll.
+//a signal mask cannot be swapped atomically for one routine,those calls stay real
+static int GetTimespecMs( const struct timespec *ts )
+{
+	if( !ts )
+	{
+		return -1;
+	}
+	long long ms = ts->tv_sec * 1000LL + ( ts->tv_nsec + 999999 ) / 1000000;
+	return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+static int CoSelect( int nfds,fd_set *readfds,fd_set *writefds,fd_set *exceptfds,int timeout )
+{
+	if( nfds < 0 || nfds > FD_SETSIZE )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	struct pollfd *fds = (struct pollfd*)calloc( nfds > 0 ? nfds : 1,sizeof(struct pollfd) );
+	int cnt = 0;
+	for(int fd=0;fd<nfds;fd++)
+	{
+		short events = 0;
+		if( readfds && FD_ISSET( fd,readfds ) ) events |= POLLIN;
+		if( writefds && FD_ISSET( fd,writefds ) ) events |= POLLOUT;
+		if( exceptfds && FD_ISSET( fd,exceptfds ) ) events |= POLLPRI;
+		if( events )
+		{
+			fds[ cnt ].fd = fd;
+			fds[ cnt ].events = events;
+			cnt++;
+		}
+	}
+	int ret = poll( fds,cnt,timeout );
+	if( ret < 0 )
+	{
+		free( fds );
+		return ret;
+	}
+	for(int i=0;i<cnt;i++)
+	{
+		if( fds[i].revents & POLLNVAL )
+		{
+			free( fds );
+			errno = EBADF;
+			return -1;
+		}
+	}
+	if( readfds ) FD_ZERO( readfds );
+	if( writefds ) FD_ZERO( writefds );
+	if( exceptfds ) FD_ZERO( exceptfds );
+	ret = 0;
+	for(int i=0;i<cnt;i++)
+	{
+		short ev = fds[i].events;
+		short rev = fds[i].revents;
+		if( ( ev & POLLIN ) && ( rev & ( POLLIN | POLLHUP | POLLERR ) ) )
+		{
+			FD_SET( fds[i].fd,readfds );
+			ret++;
+		}
+		if( ( ev & POLLOUT ) && ( rev & ( POLLOUT | POLLERR ) ) )
+		{
+			FD_SET( fds[i].fd,writefds );
+			ret++;
+		}
+		if( ( ev & POLLPRI ) && ( rev & POLLPRI ) )
+		{
+			FD_SET( fds[i].fd,exceptfds );
+			ret++;
+		}
+	}
+	free( fds );
+	return ret;
+}
+
+int select( int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout )
+{
+	HOOK_SYS_FUNC( select );
+
+	if( !co_is_enable_sys_hook() || ( timeout && !timeout->tv_sec && !timeout->tv_usec ) )
+	{
+		return g_sys_select_func( nfds,readfds,writefds,exceptfds,timeout );
+	}
+	int ms = -1;
+	if( timeout )
+	{
+		long long t = timeout->tv_sec * 1000LL + ( timeout->tv_usec + 999 ) / 1000;
+		ms = t > INT_MAX ? INT_MAX : (int)t;
+	}
+	unsigned long long begin = GetSleepNs( CLOCK_MONOTONIC ) / 1000000;
+	int ret = CoSelect( nfds,readfds,writefds,exceptfds,ms );
+	if( timeout && ret >= 0 )
+	{
+		//linux leaves the time not slept
+		long long left = ms - (long long)( GetSleepNs( CLOCK_MONOTONIC ) / 1000000 - begin );
+		left = left > 0 && ret > 0 ? left : 0;
+		timeout->tv_sec = left / 1000;
+		timeout->tv_usec = ( left % 1000 ) * 1000;
+	}
+	return ret;
+}
+int pselect( int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+		const struct timespec *timeout, const sigset_t *sigmask )
+{
+	HOOK_SYS_FUNC( pselect );
+
+	if( !co_is_enable_sys_hook() || sigmask || ( timeout && !timeout->tv_sec && !timeout->tv_nsec ) )
+	{
+		return g_sys_pselect_func( nfds,readfds,writefds,exceptfds,timeout,sigmask );
+	}
+	return CoSelect( nfds,readfds,writefds,exceptfds,GetTimespecMs( timeout ) );
+}
+int ppoll( struct pollfd *fds, nfds_t nfds, const struct timespec *tmo_p, const sigset_t *sigmask )
+{
+	HOOK_SYS_FUNC( ppoll );
+
+	if( !co_is_enable_sys_hook() || sigmask || ( tmo_p && !tmo_p->tv_sec && !tmo_p->tv_nsec ) )
+	{
+		return g_sys_ppoll_func( fds,nfds,tmo_p,sigmask );
+	}
+	return poll( fds,nfds,GetTimespecMs( tmo_p ) );
+}
+
+//an inner epoll fd is readable while it has events: wait for that in the loop,
+//then collect without blocking. co_eventloop itself waits from the main routine.
+int epoll_wait( int epfd, struct epoll_event *events, int maxevents, int timeout )
+{
+	HOOK_SYS_FUNC( epoll_wait );
+
+	if( !co_is_enable_sys_hook() || timeout == 0 || GetCurrThreadCo()->cIsMain )
+	{
+		return g_sys_epoll_wait_func( epfd,events,maxevents,timeout );
+	}
+	int ret = g_sys_epoll_wait_func( epfd,events,maxevents,0 );
+	if( ret != 0 )
+	{
+		return ret;
+	}
+	HOOK_SYS_ENTRY( "epoll_wait",epfd );
+	struct pollfd pf = { 0 };
+	pf.fd = epfd;
+	pf.events = POLLIN;
+	unsigned long long begin = GetSleepNs( CLOCK_MONOTONIC ) / 1000000;
+	for(;;)
+	{
+		int left = timeout;
+		if( timeout > 0 )
+		{
+			long long t = timeout - (long long)( GetSleepNs( CLOCK_MONOTONIC ) / 1000000 - begin );
+			left = t > 0 ? (int)t : 0;
+		}
+		ret = co_poll_inner( co_get_epoll_ct(),&pf,1,left,g_sys_poll_func );
+		if( ret <= 0 )
+		{
+			break; //timeout or cancel
+		}
+		//another waiter may have taken the events
+		ret = g_sys_epoll_wait_func( epfd,events,maxevents,0 );
+		if( ret != 0 || left == 0 )
+		{
+			break;
+		}
+	}
+	HOOK_SYS_EXIT( "epoll_wait",epfd,ret );
+	return ret;
+}
+int setsockopt(int fd, int level, int option_name,
+			                 const void *option_value, socklen_t option_len)
+{
+	HOOK_SYS_FUNC( setsockopt );
+
+	if( !co_is_enable_sys_hook() )
+	{
+		return g_sys_setsockopt_func( fd,level,option_name,option_value,option_len );
+	}
+	rpchook_t *lp = get_by_fd( fd );
+
+	if( lp && SOL_SOCKET == level )
+	{
+		struct timeval *val = (struct timeval*)option_value;
+		if( SO_RCVTIMEO == option_name  ) 
+		{
+			memcpy( &lp->read_timeout,val,sizeof(*val) );
+		}
+		else if( SO_SNDTIMEO == option_name )
+		{
+			memcpy( &lp->write_timeout,val,sizeof(*val) );
+		}
+	}
+	return g_sys_setsockopt_func( fd,level,option_name,option_value,option_len );
+}
+
+
+int fcntl(int fildes, int cmd, ...)
+{
+	HOOK_SYS_FUNC( fcntl );
+
+	if( fildes < 0 )
+	{
+		return __LINE__;
+	}
+
+	va_list arg_list;
+	va_start( arg_list,cmd );
+
+	int ret = -1;
+	rpchook_t *lp = get_by_fd( fildes );
+	switch( cmd )
+	{
+		case F_DUPFD:
+		{
+			int param = va_arg(arg_list,int);
+			ret = g_sys_fcntl_func( fildes,cmd,param );
+			break;
+		}
+		case F_GETFD:
+		{
+			ret = g_sys_fcntl_func( fildes,cmd );
+			break;
+		}
+		case F_SETFD:
+		{
+			int param = va_arg(arg_list,int);
+			ret = g_sys_fcntl_func( fildes,cmd,param );
+			break;
+		}
+		case F_GETFL:
+		{
+			ret = g_sys_fcntl_func( fildes,cmd );
+			break;
+		}
+		case F_SETFL:
+		{
+			int param = va_arg(arg_list,int);
+			int flag = param;
+			if( co_is_enable_sys_hook() && lp )
+			{
+				flag |= O_NONBLOCK;
+			}
+			ret = g_sys_fcntl_func( fildes,cmd,flag );
+			if( 0 == ret && lp )
+			{
+				lp->user_flag = param;
+			}
+			break;
+		}
+		case F_GETOWN:
+		{
+			ret = g_sys_fcntl_func( fildes,cmd );
+			break;
+		}
+		case F_SETOWN:
+		{
+			int param = va_arg(arg_list,int);
+			ret = g_sys_fcntl_func( fildes,cmd,param );
+			break;
+		}
+		case F_GETLK:
+		{
+			struct flock *param = va_arg(arg_list,struct flock *);
+			ret = g_sys_fcntl_func( fildes,cmd,param );
+			break;
+		}
+		case F_SETLK:
+		{
+			struct flock *param = va_arg(arg_list,struct flock *);
+			ret = g_sys_fcntl_func( fildes,cmd,param );
+			break;
+		}
+		case F_SETLKW:
+		{
+			struct flock *param = va_arg(arg_list,struct flock *);
+			ret = g_sys_fcntl_func( fildes,cmd,param );
+			break;
+		}
+	}
+
+	va_end( arg_list );
+
+	return ret;
 }
 
 struct stCoSysEnv_t
@@ -911,6 +2186,69 @@ char *getenv( const char *n )
 	return g_sys_getenv_func( n );
 
 }
+
+//localtime_r: glibc takes the tz lock on every call. keep the local day of the
+//last call per thread,times inside it are shifted from that day's midnight.
+//a day whose utc offset changes ( dst ) is never cached.
+struct stCoLocalDay_t
+{
+	time_t tStart;
+	time_t tEnd;
+	struct tm stMidnight;
+	unsigned int iGen;
+};
+static __thread stCoLocalDay_t t_local_day = { 0,0,{ 0 },0 };
+static unsigned int g_tz_gen = 1; //bumped by tzset,0 never matches
+
+void tzset()
+{
+	HOOK_SYS_FUNC( tzset );
+	g_sys_tzset_func();
+	__atomic_add_fetch( &g_tz_gen,1,__ATOMIC_RELEASE );
+}
+
+struct tm *localtime_r( const time_t *timep, struct tm *result )
+{
+	HOOK_SYS_FUNC( localtime_r );
+
+	if( !co_is_enable_sys_hook() || !timep || !result )
+	{
+		return g_sys_localtime_r_func( timep,result );
+	}
+	stCoLocalDay_t *day = &t_local_day;
+	time_t t = *timep;
+	if( day->iGen == __atomic_load_n( &g_tz_gen,__ATOMIC_ACQUIRE ) && t >= day->tStart && t < day->tEnd )
+	{
+		int sec = t - day->tStart;
+		*result = day->stMidnight;
+		result->tm_hour = sec / 3600;
+		result->tm_min = sec / 60 % 60;
+		result->tm_sec = sec % 60;
+		return result;
+	}
+	unsigned int gen = __atomic_load_n( &g_tz_gen,__ATOMIC_ACQUIRE );
+	if( !g_sys_localtime_r_func( timep,result ) )
+	{
+		return NULL;
+	}
+	struct tm last;
+	time_t start = t - ( result->tm_hour * 3600 + result->tm_min * 60 + result->tm_sec );
+	time_t end = start + 86400;
+	time_t before_end = end - 1;
+	struct tm midnight;
+	if( result->tm_sec < 60 //not a leap second
+		&& g_sys_localtime_r_func( &start,&midnight ) && g_sys_localtime_r_func( &before_end,&last )
+		&& midnight.tm_gmtoff == result->tm_gmtoff && last.tm_gmtoff == result->tm_gmtoff
+		&& midnight.tm_hour == 0 && midnight.tm_min == 0 && midnight.tm_sec == 0 )
+	{
+		day->tStart = start;
+		day->tEnd = end;
+		day->stMidnight = midnight;
+		day->iGen = gen;
+	}
+	return result;
+}
+
 struct hostent* co_gethostbyname(const char *name);
 
 struct hostent *gethostbyname(const char *name)
@@ -929,11 +2267,36 @@ struct hostent *gethostbyname(const char *name)
 
 }
 
+int getaddrinfo(const char *node, const char *service,
+		const struct addrinfo *hints, struct addrinfo **res)
+{
+	HOOK_SYS_FUNC( getaddrinfo );
+
+	//numeric hosts and services never leave the process
+	struct in6_addr addr;
+	if( !co_is_enable_sys_hook() || !node || ( hints && ( hints->ai_flags & AI_NUMERICHOST ) )
+		|| inet_pton( AF_INET,node,&addr ) == 1 || inet_pton( AF_INET6,node,&addr ) == 1 )
+	{
+		return g_sys_getaddrinfo_func( node,service,hints,res );
+	}
+	HOOK_SYS_ENTRY( "getaddrinfo",-1 );
+	int ret = co_getaddrinfo( node,service,hints,res );
+	HOOK_SYS_EXIT( "getaddrinfo",-1,ret );
+	return ret;
+}
+
 
 struct res_state_wrap
 {
 	struct __res_state state;
 };
+static void co_routine_specific_cleanup( res_state_wrap *p )
+{
+	if( p->state.options & RES_INIT )
+	{
+		res_nclose( &p->state );
+	}
+}
 CO_ROUTINE_SPECIFIC(res_state_wrap, __co_state_wrap);
 
 extern "C"
@@ -962,47 +2325,64 @@ struct hostbuf_wrap
 	size_t iBufferSize;
 	int host_errno;
 };
+static void co_routine_specific_cleanup( hostbuf_wrap *p )
+{
+	free( p->buffer );
+}
 
 CO_ROUTINE_SPECIFIC(hostbuf_wrap, __co_hostbuf_wrap);
 
 #if !defined( __APPLE__ ) && !defined( __FreeBSD__ )
+//through co_resolve,so lookups are cached and coalesced like getaddrinfo
 struct hostent *co_gethostbyname(const char *name)
 {
 	if (!name)
 	{
 		return NULL;
 	}
+	struct sockaddr_storage addrs[ 16 ];
+	int n = co_resolve( name,AF_INET,addrs,sizeof(addrs) / sizeof(addrs[0]) );
+	if( n <= 0 )
+	{
+		h_errno = errno == ENOENT ? HOST_NOT_FOUND :
+			( errno == ENODATA ? NO_DATA : TRY_AGAIN );
+		return NULL;
+	}
 
-	if (__co_hostbuf_wrap->buffer && __co_hostbuf_wrap->iBufferSize > 1024)
+	//name,alias list,addr list,addrs
+	size_t namelen = strlen( name ) + 1;
+	size_t need = ( namelen + sizeof(char*) - 1 ) / sizeof(char*) * sizeof(char*)
+		+ sizeof(char*) + ( n + 1 ) * sizeof(char*) + n * sizeof(struct in_addr);
+	if (__co_hostbuf_wrap->buffer && __co_hostbuf_wrap->iBufferSize < need)
 	{
 		free(__co_hostbuf_wrap->buffer);
 		__co_hostbuf_wrap->buffer = NULL;
 	}
 	if (!__co_hostbuf_wrap->buffer)
 	{
-		__co_hostbuf_wrap->buffer = (char*)malloc(1024);
-		__co_hostbuf_wrap->iBufferSize = 1024;
-	}
-
-	struct hostent *host = &__co_hostbuf_wrap->host;
-	struct hostent *result = NULL;
-	int *h_errnop = &(__co_hostbuf_wrap->host_errno);
-
-	int ret = -1;
-	while (ret = gethostbyname_r(name, host, __co_hostbuf_wrap->buffer, 
-				__co_hostbuf_wrap->iBufferSize, &result, h_errnop) == ERANGE && 
-				*h_errnop == NETDB_INTERNAL )
-	{
-		free(__co_hostbuf_wrap->buffer);
-		__co_hostbuf_wrap->iBufferSize = __co_hostbuf_wrap->iBufferSize * 2;
+		__co_hostbuf_wrap->iBufferSize = need > 1024 ? need : 1024;
 		__co_hostbuf_wrap->buffer = (char*)malloc(__co_hostbuf_wrap->iBufferSize);
 	}
-
-	if (ret == 0 && (host == result)) 
+	char *p = __co_hostbuf_wrap->buffer;
+	struct hostent *host = &__co_hostbuf_wrap->host;
+	host->h_name = p;
+	memcpy( p,name,namelen );
+	p += ( namelen + sizeof(char*) - 1 ) / sizeof(char*) * sizeof(char*);
+	host->h_aliases = (char**)p;
+	host->h_aliases[0] = NULL;
+	p += sizeof(char*);
+	host->h_addr_list = (char**)p;
+	p += ( n + 1 ) * sizeof(char*);
+	for(int i=0;i<n;i++)
 	{
-		return host;
+		memcpy( p,&( (struct sockaddr_in*)( addrs + i ) )->sin_addr,sizeof(struct in_addr) );
+		host->h_addr_list[i] = p;
+		p += sizeof(struct in_addr);
 	}
-	return NULL;
+	host->h_addr_list[n] = NULL;
+	host->h_addrtype = AF_INET;
+	host->h_length = sizeof(struct in_addr);
+	return host;
 }
 #endif
 
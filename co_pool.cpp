@@ -0,0 +1,482 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <map>
+
+//everything is touched by routines of one loop only,so no locks: a pool
+//field only changes under our feet across a park ( connect,check,cond ).
+struct stCoPoolIdle_t
+{
+	int fd;
+	unsigned long long ullSince;
+};
+struct stCoPoolDest_t
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	std::deque<stCoPoolIdle_t> idle; //back is the most recently returned
+	int iOpen; //idle,borrowed and being connected
+	int iWaiters;
+	stCoCond_t *cond;
+};
+typedef std::map<std::string,stCoPoolDest_t*> CoPoolDests_t;
+struct stCoPool_t
+{
+	stCoPoolAttr_t attr;
+	CoPoolDests_t dests;
+	std::map<int,stCoPoolDest_t*> borrowed;
+
+	stCoRoutine_t *checker;
+	bool bStop;
+	int iRef; //the checker and routines inside co_pool_borrow,the last one frees
+	stCoPoolStat_t stat;
+};
+
+static unsigned long long GetPoolTickMS()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC,&ts );
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool DestKey( const struct sockaddr *addr,socklen_t len,std::string &key )
+{
+	if( !addr || len <= 0 || len > (socklen_t)sizeof(struct sockaddr_storage) )
+	{
+		return false;
+	}
+	//only what identifies the peer,not padding
+	key.assign( 1,(char)addr->sa_family );
+	if( addr->sa_family == AF_INET && len >= (socklen_t)sizeof(struct sockaddr_in) )
+	{
+		const struct sockaddr_in *in = (const struct sockaddr_in*)addr;
+		key.append( (const char*)&in->sin_port,sizeof(in->sin_port) );
+		key.append( (const char*)&in->sin_addr,sizeof(in->sin_addr) );
+	}
+	else if( addr->sa_family == AF_INET6 && len >= (socklen_t)sizeof(struct sockaddr_in6) )
+	{
+		const struct sockaddr_in6 *in6 = (const struct sockaddr_in6*)addr;
+		key.append( (const char*)&in6->sin6_port,sizeof(in6->sin6_port) );
+		key.append( (const char*)&in6->sin6_addr,sizeof(in6->sin6_addr) );
+		key.append( (const char*)&in6->sin6_scope_id,sizeof(in6->sin6_scope_id) );
+	}
+	else
+	{
+		key.append( (const char*)addr,len );
+	}
+	return true;
+}
+
+//an idle connection has nothing to say: readable means eof or garbage
+static bool IsIdleAlive( int fd )
+{
+	struct pollfd pf = { fd,POLLIN,0 };
+	return poll( &pf,1,0 ) == 0;
+}
+
+static int ConnectDest( stCoPoolDest_t *dest,int timeout_ms )
+{
+	int fd = socket( dest->addr.ss_family,SOCK_STREAM,0 );
+	if( fd < 0 )
+	{
+		return -1;
+	}
+	//the hooked connect waits up to 75s,so do our own wait
+	int flags = fcntl( fd,F_GETFL,0 ) & ~O_NONBLOCK;
+	fcntl( fd,F_SETFL,flags | O_NONBLOCK );
+	int ret = connect( fd,(struct sockaddr*)&dest->addr,dest->addrlen );
+	if( ret < 0 && errno == EINPROGRESS )
+	{
+		struct pollfd pf = { fd,POLLOUT,0 };
+		ret = poll( &pf,1,timeout_ms );
+		if( ret == 0 )
+		{
+			errno = ETIMEDOUT;
+			ret = -1;
+		}
+		else if( ret > 0 )
+		{
+			int err = 0;
+			socklen_t errlen = sizeof(err);
+			getsockopt( fd,SOL_SOCKET,SO_ERROR,&err,&errlen );
+			errno = err;
+			ret = err ? -1 : 0;
+		}
+	}
+	if( ret < 0 )
+	{
+		int err = errno;
+		close( fd );
+		errno = err;
+		return -1;
+	}
+	fcntl( fd,F_SETFL,flags ); //blocking as far as the borrower can tell
+	return fd;
+}
+
+static void CloseConn( stCoPoolDest_t *dest,int fd )
+{
+	close( fd );
+	dest->iOpen--;
+	//a slot is free,a waiter may connect
+	co_cond_signal( dest->cond );
+}
+
+static stCoPoolDest_t *GetDest( stCoPool_t *pool,const struct sockaddr *addr,socklen_t len )
+{
+	std::string key;
+	if( !DestKey( addr,len,key ) )
+	{
+		return NULL;
+	}
+	CoPoolDests_t::iterator it = pool->dests.find( key );
+	if( it != pool->dests.end() )
+	{
+		return it->second;
+	}
+	stCoPoolDest_t *dest = new stCoPoolDest_t();
+	memset( &dest->addr,0,sizeof(dest->addr) );
+	memcpy( &dest->addr,addr,len );
+	dest->addrlen = len;
+	dest->iOpen = 0;
+	dest->iWaiters = 0;
+	dest->cond = co_cond_alloc();
+	pool->dests[ key ] = dest;
+	return dest;
+}
+
+static void FreeDest( stCoPoolDest_t *dest )
+{
+	for( size_t i = 0;i < dest->idle.size();i++ )
+	{
+		close( dest->idle[i].fd );
+	}
+	co_cond_free( dest->cond );
+	delete dest;
+}
+
+static void CheckDest( stCoPool_t *pool,stCoPoolDest_t *dest )
+{
+	const stCoPoolAttr_t &attr = pool->attr;
+	unsigned long long now = GetPoolTickMS();
+
+	//oldest first,and never below the floor we would reconnect right away
+	while( (int)dest->idle.size() > attr.min_idle_per_dest
+			&& now - dest->idle.front().ullSince >= (unsigned long long)attr.idle_timeout_ms )
+	{
+		int fd = dest->idle.front().fd;
+		dest->idle.pop_front();
+		pool->stat.ullEvicted++;
+		CloseConn( dest,fd );
+	}
+
+	for( size_t i = 0;i < dest->idle.size(); )
+	{
+		if( IsIdleAlive( dest->idle[i].fd ) )
+		{
+			i++;
+			continue;
+		}
+		int fd = dest->idle[i].fd;
+		dest->idle.erase( dest->idle.begin() + i );
+		pool->stat.ullBroken++;
+		CloseConn( dest,fd );
+	}
+
+	if( attr.check && !dest->idle.empty() )
+	{
+		//out of the idle list while probed,borrowers connect rather than wait
+		std::vector<stCoPoolIdle_t> probe( dest->idle.begin(),dest->idle.end() );
+		dest->idle.clear();
+		std::vector<stCoPoolIdle_t> good;
+		for( size_t i = 0;i < probe.size();i++ )
+		{
+			if( !pool->bStop && attr.check( probe[i].fd,attr.check_arg ) == 0 )
+			{
+				good.push_back( probe[i] );
+				continue;
+			}
+			if( !pool->bStop )
+			{
+				pool->stat.ullBroken++;
+			}
+			CloseConn( dest,probe[i].fd );
+		}
+		//older than anything returned meanwhile
+		dest->idle.insert( dest->idle.begin(),good.begin(),good.end() );
+	}
+
+	while( !pool->bStop && (int)dest->idle.size() < attr.min_idle_per_dest
+			&& dest->iOpen < attr.max_per_dest )
+	{
+		dest->iOpen++;
+		int fd = ConnectDest( dest,attr.connect_timeout_ms );
+		if( fd < 0 )
+		{
+			dest->iOpen--;
+			pool->stat.ullConnectFails++;
+			break; //next lap
+		}
+		pool->stat.ullConnects++;
+		stCoPoolIdle_t item = { fd,GetPoolTickMS() };
+		dest->idle.push_back( item );
+		co_cond_signal( dest->cond );
+	}
+}
+
+static void ReleasePool( stCoPool_t *pool )
+{
+	if( --pool->iRef > 0 )
+	{
+		return ;
+	}
+	for( CoPoolDests_t::iterator it = pool->dests.begin();it != pool->dests.end();++it )
+	{
+		FreeDest( it->second );
+	}
+	delete pool;
+}
+
+static void *PoolChecker( void *arg )
+{
+	co_enable_hook_sys();
+	co_set_deadline( -1 ); //not the one of whoever made the pool
+	stCoPool_t *pool = (stCoPool_t*)arg;
+	while( !pool->bStop )
+	{
+		poll( NULL,0,pool->attr.check_interval_ms );
+		//the map only grows while we park,iterators stay good
+		for( CoPoolDests_t::iterator it = pool->dests.begin();it != pool->dests.end() && !pool->bStop; )
+		{
+			stCoPoolDest_t *dest = it->second;
+			CheckDest( pool,dest );
+			if( !dest->iOpen && !dest->iWaiters && !pool->attr.min_idle_per_dest )
+			{
+				FreeDest( dest );
+				pool->dests.erase( it++ );
+				continue;
+			}
+			++it;
+		}
+	}
+	//co_pool_free has returned,borrowers still parked may hold it a bit longer
+	ReleasePool( pool );
+	return NULL;
+}
+
+stCoPool_t *co_pool_alloc( const stCoPoolAttr_t *attr )
+{
+	stCoPool_t *pool = new stCoPool_t();
+	if( attr )
+	{
+		pool->attr = *attr;
+	}
+	if( pool->attr.max_per_dest <= 0 )
+	{
+		pool->attr.max_per_dest = 1;
+	}
+	if( pool->attr.min_idle_per_dest > pool->attr.max_per_dest )
+	{
+		pool->attr.min_idle_per_dest = pool->attr.max_per_dest;
+	}
+	//0 or less for the defaults
+	stCoPoolAttr_t def;
+	if( pool->attr.idle_timeout_ms <= 0 )
+	{
+		pool->attr.idle_timeout_ms = def.idle_timeout_ms;
+	}
+	if( pool->attr.connect_timeout_ms <= 0 )
+	{
+		pool->attr.connect_timeout_ms = def.connect_timeout_ms;
+	}
+	if( pool->attr.check_interval_ms <= 0 )
+	{
+		pool->attr.check_interval_ms = def.check_interval_ms;
+	}
+	pool->bStop = false;
+	pool->iRef = 1;
+	memset( &pool->stat,0,sizeof(pool->stat) );
+	pool->checker = co_spawn_detached( PoolChecker,pool );
+	if( !pool->checker )
+	{
+		delete pool;
+		return NULL;
+	}
+	return pool;
+}
+
+void co_pool_free( stCoPool_t *pool )
+{
+	if( !pool )
+	{
+		return ;
+	}
+	//the checker and waiting borrowers are parked: they wake on a later lap,
+	//see bStop and go,the last one frees the pool
+	pool->bStop = true;
+	for( CoPoolDests_t::iterator it = pool->dests.begin();it != pool->dests.end();++it )
+	{
+		co_cond_broadcast( it->second->cond );
+	}
+	co_cancel( pool->checker );
+}
+
+static int Borrow( stCoPool_t *pool,stCoPoolDest_t *dest,int timeout_ms )
+{
+	unsigned long long deadline = timeout_ms > 0 ? GetPoolTickMS() + timeout_ms : 0;
+	for(;;)
+	{
+		while( !dest->idle.empty() )
+		{
+			int fd = dest->idle.back().fd;
+			dest->idle.pop_back();
+			if( !IsIdleAlive( fd ) )
+			{
+				pool->stat.ullBroken++;
+				CloseConn( dest,fd );
+				continue;
+			}
+			pool->stat.ullReuses++;
+			pool->borrowed[ fd ] = dest;
+			return fd;
+		}
+
+		int left = 0;
+		if( deadline )
+		{
+			unsigned long long now = GetPoolTickMS();
+			if( now >= deadline )
+			{
+				errno = ETIMEDOUT;
+				return -1;
+			}
+			left = deadline - now;
+		}
+		if( dest->iOpen < pool->attr.max_per_dest )
+		{
+			int ms = pool->attr.connect_timeout_ms;
+			if( left && left < ms )
+			{
+				ms = left;
+			}
+			dest->iOpen++;
+			int fd = ConnectDest( dest,ms );
+			if( fd < 0 )
+			{
+				int err = errno;
+				pool->stat.ullConnectFails++;
+				dest->iOpen--;
+				co_cond_signal( dest->cond );
+				errno = err;
+				return -1;
+			}
+			if( pool->bStop )
+			{
+				CloseConn( dest,fd );
+				errno = ECANCELED;
+				return -1;
+			}
+			pool->stat.ullConnects++;
+			pool->borrowed[ fd ] = dest;
+			return fd;
+		}
+
+		//signalled when a connection comes back or a slot frees up
+		dest->iWaiters++;
+		int ret = co_cond_timedwait( dest->cond,left );
+		dest->iWaiters--;
+		if( pool->bStop )
+		{
+			errno = ECANCELED;
+			return -1;
+		}
+		if( ret < 0 )
+		{
+			return -1;
+		}
+	}
+}
+
+int co_pool_borrow( stCoPool_t *pool,const struct sockaddr *addr,socklen_t addrlen,int timeout_ms )
+{
+	stCoPoolDest_t *dest = pool->bStop ? NULL : GetDest( pool,addr,addrlen );
+	if( !dest )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	//dest and pool stay alive while we park,even past co_pool_free
+	pool->iRef++;
+	int fd = Borrow( pool,dest,timeout_ms );
+	int err = errno;
+	ReleasePool( pool );
+	errno = err;
+	return fd;
+}
+
+int co_pool_return( stCoPool_t *pool,int fd,bool reuse )
+{
+	std::map<int,stCoPoolDest_t*>::iterator it = pool->borrowed.find( fd );
+	if( it == pool->borrowed.end() )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	stCoPoolDest_t *dest = it->second;
+	pool->borrowed.erase( it );
+	if( !reuse || !IsIdleAlive( fd ) )
+	{
+		pool->stat.ullBroken++;
+		CloseConn( dest,fd );
+		return 0;
+	}
+	stCoPoolIdle_t item = { fd,GetPoolTickMS() };
+	dest->idle.push_back( item );
+	co_cond_signal( dest->cond );
+	return 0;
+}
+
+void co_pool_get_stat( stCoPool_t *pool,stCoPoolStat_t *stat )
+{
+	*stat = pool->stat;
+	stat->iDests = pool->dests.size();
+	stat->iIdle = 0;
+	stat->iWaiters = 0;
+	for( CoPoolDests_t::iterator it = pool->dests.begin();it != pool->dests.end();++it )
+	{
+		stat->iIdle += it->second->idle.size();
+		stat->iWaiters += it->second->iWaiters;
+	}
+	stat->iBusy = pool->borrowed.size();
+}
@@ -0,0 +1,63 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __CO_PROBE_H__
+#define __CO_PROBE_H__
+
+//USDT tracepoints,provider libco.
+//a probe is a nop until perf/bpftrace attach to it,eg.
+//	bpftrace -e 'usdt:./libcolib.so:libco:poll_park { @[arg1] = count(); }'
+//
+//	create		( id,pfn )
+//	resume		( from id,to id )
+//	yield		( from id,to id )
+//	stack_save	( id,bytes ) copy-stack routine swapped out
+//	stack_restore	( id,bytes )
+//	poll_park	( id,first fd,nfds,timeout ms,park tick ms )
+//	poll_wake	( id,first fd,ready cnt,park tick ms )
+//	timer_fire	( item,expire tick ms,now tick ms )
+//	sys_entry	( name,fd )
+//	sys_exit	( name,fd,ret )
+//
+//probes are compiled in when <sys/sdt.h> ( systemtap-sdt-dev ) is found,
+//define __LIBCO_NO_PROBE__ to leave them out.
+
+#if !defined( __LIBCO_NO_PROBE__ ) && defined( __has_include )
+#if __has_include( <sys/sdt.h> )
+#include <sys/sdt.h>
+#define __LIBCO_PROBE__ 1
+#endif
+#endif
+
+#if defined( __LIBCO_PROBE__ )
+
+#define CO_PROBE2( name,a1,a2 ) DTRACE_PROBE2( libco,name,a1,a2 )
+#define CO_PROBE3( name,a1,a2,a3 ) DTRACE_PROBE3( libco,name,a1,a2,a3 )
+#define CO_PROBE4( name,a1,a2,a3,a4 ) DTRACE_PROBE4( libco,name,a1,a2,a3,a4 )
+#define CO_PROBE5( name,a1,a2,a3,a4,a5 ) DTRACE_PROBE5( libco,name,a1,a2,a3,a4,a5 )
+
+#else
+
+#define CO_PROBE2( name,a1,a2 ) do {} while(0)
+#define CO_PROBE3( name,a1,a2,a3 ) do {} while(0)
+#define CO_PROBE4( name,a1,a2,a3,a4 ) do {} while(0)
+#define CO_PROBE5( name,a1,a2,a3,a4,a5 ) do {} while(0)
+
+#endif
+
+#endif
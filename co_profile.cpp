@@ -0,0 +1,345 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <ucontext.h>
+#include <sys/time.h>
+#include <cxxabi.h>
+
+//samples are folded into a fixed open addressing table inside the handler:
+//no malloc,no lock,and a full table only drops samples.
+enum
+{
+	eMaxProfFrames = 48,
+	eProfSlots = 8192, //power of 2
+	eProfProbe = 32,
+};
+enum
+{
+	eSlotEmpty = 0,
+	eSlotBusy,
+	eSlotReady,
+};
+struct stProfSlot_t
+{
+	int iState;
+	unsigned long long ullHash;
+	unsigned long long ullId; //0 unless CO_PROFILE_BY_ROUTINE
+	const char *pszTag;
+	int iDepth;
+	void *aFrames[ eMaxProfFrames ]; //leaf first
+	unsigned long long ullCnt;
+};
+
+static stProfSlot_t *g_prof_slots = NULL;
+static int g_prof_flags = 0;
+static volatile int g_prof_running = 0;
+static unsigned long long g_prof_samples = 0;
+static unsigned long long g_prof_dropped = 0;
+static struct sigaction g_prof_old_sa;
+
+void co_set_tag( const char *tag )
+{
+	stCoRoutine_t *co = co_self();
+	if( co )
+	{
+		co->pszTag = tag;
+	}
+}
+
+//frame pointer walk bounded by the stack of the routine we are on:
+//[ctx.ss_sp,ctx.ss_sp + ss_size) as laid out by coctx_make,
+//or the thread stack recorded for the main routine.
+static int UnwindSample( stCoRoutine_t *co,ucontext_t *uc,void **frames )
+{
+	int n = 0;
+#if defined(__x86_64__)
+	char *pc = (char*)uc->uc_mcontext.gregs[ REG_RIP ];
+	char *sp = (char*)uc->uc_mcontext.gregs[ REG_RSP ];
+	char *fp = (char*)uc->uc_mcontext.gregs[ REG_RBP ];
+#elif defined(__i386__)
+	char *pc = (char*)uc->uc_mcontext.gregs[ REG_EIP ];
+	char *sp = (char*)uc->uc_mcontext.gregs[ REG_ESP ];
+	char *fp = (char*)uc->uc_mcontext.gregs[ REG_EBP ];
+#else
+	char *pc = NULL;
+	char *sp = NULL;
+	char *fp = NULL;
+#endif
+	frames[ n++ ] = pc;
+
+	char *lo = co ? co->ctx.ss_sp : NULL;
+	char *hi = lo ? lo + co->ctx.ss_size : NULL;
+
+	//inside coctx_swap or before the call stack is updated sp is not ours
+	if( !lo || sp < lo || sp >= hi )
+	{
+		return n;
+	}
+	while( n < eMaxProfFrames )
+	{
+		if( fp < sp || fp + 2 * sizeof(void*) > hi || ( (unsigned long)fp & ( sizeof(void*) - 1 ) ) )
+		{
+			break;
+		}
+		void **frame = (void**)fp;
+		if( !frame[1] )
+		{
+			break;
+		}
+		frames[ n++ ] = frame[1];
+		if( (char*)frame[0] <= fp )
+		{
+			break;
+		}
+		fp = (char*)frame[0];
+	}
+	return n;
+}
+
+static unsigned long long HashSample( unsigned long long id,const char *tag,void **frames,int n )
+{
+	unsigned long long h = 14695981039346656037ULL;
+	h = ( h ^ id ) * 1099511628211ULL;
+	h = ( h ^ (unsigned long)tag ) * 1099511628211ULL;
+	for(int i=0;i<n;i++)
+	{
+		h = ( h ^ (unsigned long)frames[i] ) * 1099511628211ULL;
+	}
+	return h ? h : 1;
+}
+
+static bool SameSample( stProfSlot_t *s,unsigned long long id,const char *tag,void **frames,int n )
+{
+	return s->ullId == id && s->pszTag == tag && s->iDepth == n
+		&& memcmp( s->aFrames,frames,n * sizeof(void*) ) == 0;
+}
+
+static void AddSample( unsigned long long id,const char *tag,void **frames,int n )
+{
+	unsigned long long h = HashSample( id,tag,frames,n );
+	for(int i=0;i<eProfProbe;i++)
+	{
+		stProfSlot_t *s = g_prof_slots + ( ( h + i ) & ( eProfSlots - 1 ) );
+		int state = __atomic_load_n( &s->iState,__ATOMIC_ACQUIRE );
+		if( state == eSlotEmpty )
+		{
+			int expect = eSlotEmpty;
+			if( __atomic_compare_exchange_n( &s->iState,&expect,(int)eSlotBusy,false,
+						__ATOMIC_ACQUIRE,__ATOMIC_RELAXED ) )
+			{
+				s->ullHash = h;
+				s->ullId = id;
+				s->pszTag = tag;
+				s->iDepth = n;
+				memcpy( s->aFrames,frames,n * sizeof(void*) );
+				s->ullCnt = 1;
+				__atomic_store_n( &s->iState,(int)eSlotReady,__ATOMIC_RELEASE );
+				return ;
+			}
+			state = expect;
+		}
+		//a slot being filled by another thread is skipped,dump sums duplicates
+		if( state == eSlotReady && s->ullHash == h && SameSample( s,id,tag,frames,n ) )
+		{
+			__atomic_add_fetch( &s->ullCnt,1,__ATOMIC_RELAXED );
+			return ;
+		}
+	}
+	__atomic_add_fetch( &g_prof_dropped,1,__ATOMIC_RELAXED );
+}
+
+static void OnProfSignal( int,siginfo_t *,void *ctx )
+{
+	if( !g_prof_running )
+	{
+		return ;
+	}
+	int saved = errno;
+
+	stCoRoutineEnv_t *env = co_get_curr_thread_env();
+	stCoRoutine_t *co = NULL;
+	if( env && env->iCallStackSize > 0 )
+	{
+		co = env->pCallStack[ env->iCallStackSize - 1 ];
+	}
+	void *frames[ eMaxProfFrames ];
+	int n = UnwindSample( co,(ucontext_t*)ctx,frames );
+
+	unsigned long long id = ( co && ( g_prof_flags & CO_PROFILE_BY_ROUTINE ) ) ? co->ullId : 0;
+	AddSample( id,co ? co->pszTag : NULL,frames,n );
+	__atomic_add_fetch( &g_prof_samples,1,__ATOMIC_RELAXED );
+
+	errno = saved;
+}
+
+int co_profile_start( int hz,int flags )
+{
+	if( g_prof_running || hz <= 0 || hz > 1000000 )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if( !g_prof_slots )
+	{
+		g_prof_slots = (stProfSlot_t*)calloc( eProfSlots,sizeof(stProfSlot_t) );
+		if( !g_prof_slots )
+		{
+			return -1;
+		}
+	}
+	g_prof_flags = flags;
+
+	struct sigaction sa;
+	memset( &sa,0,sizeof(sa) );
+	sa.sa_sigaction = OnProfSignal;
+	sa.sa_flags = SA_RESTART | SA_SIGINFO;
+	sigemptyset( &sa.sa_mask );
+	if( sigaction( SIGPROF,&sa,&g_prof_old_sa ) < 0 )
+	{
+		return -1;
+	}
+	g_prof_running = 1;
+
+	struct itimerval it;
+	it.it_interval.tv_sec = 1 / hz;
+	it.it_interval.tv_usec = ( 1000000 / hz ) % 1000000; //tv_usec stays below a second for hz 1
+	it.it_value = it.it_interval;
+	if( setitimer( ITIMER_PROF,&it,NULL ) < 0 )
+	{
+		g_prof_running = 0;
+		sigaction( SIGPROF,&g_prof_old_sa,NULL );
+		return -1;
+	}
+	return 0;
+}
+void co_profile_stop()
+{
+	if( !g_prof_running )
+	{
+		return ;
+	}
+	struct itimerval it;
+	memset( &it,0,sizeof(it) );
+	setitimer( ITIMER_PROF,&it,NULL );
+
+	//keep our handler: a SIGPROF already pending must not kill the process
+	g_prof_running = 0;
+}
+
+static int AppendFrame( char *buf,int len,int size,void *addr,bool leaf )
+{
+	//return addresses point after the call
+	void *lookup = leaf ? addr : (void*)( (char*)addr - 1 );
+
+	Dl_info info;
+	memset( &info,0,sizeof(info) );
+	if( dladdr( lookup,&info ) && info.dli_sname )
+	{
+		int status = 0;
+		char *name = abi::__cxa_demangle( info.dli_sname,NULL,NULL,&status );
+		len += snprintf( buf + len,len < size ? size - len : 0,";%s",
+				( status == 0 && name ) ? name : info.dli_sname );
+		free( name );
+	}
+	else if( info.dli_fname )
+	{
+		const char *base = strrchr( info.dli_fname,'/' );
+		len += snprintf( buf + len,len < size ? size - len : 0,";%s+%#lx",
+				base ? base + 1 : info.dli_fname,(unsigned long)( (char*)addr - (char*)info.dli_fbase ) );
+	}
+	else
+	{
+		len += snprintf( buf + len,len < size ? size - len : 0,";%p",addr );
+	}
+	return len;
+}
+
+int co_profile_dump( int fd )
+{
+	if( !g_prof_slots )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	FILE *fp = fdopen( dup( fd ),"w" );
+	if( !fp )
+	{
+		return -1;
+	}
+	int lines = 0;
+	char *buf = (char*)malloc( 64 * 1024 );
+	const int size = 64 * 1024;
+	for(int i=0;i<eProfSlots;i++)
+	{
+		stProfSlot_t *s = g_prof_slots + i;
+		if( __atomic_load_n( &s->iState,__ATOMIC_ACQUIRE ) != eSlotReady )
+		{
+			continue;
+		}
+		int len = snprintf( buf,size,"%s",s->pszTag ? s->pszTag : "[untagged]" );
+		if( s->ullId )
+		{
+			len += snprintf( buf + len,size - len,";[routine %llu]",s->ullId );
+		}
+		//folded stacks are root first
+		for(int j=s->iDepth - 1;j>=0;j--)
+		{
+			len = AppendFrame( buf,len,size,s->aFrames[j],j == 0 );
+		}
+		if( len >= size )
+		{
+			len = size - 1;
+		}
+		buf[ len ] = '\0';
+		fprintf( fp,"%s %llu\n",buf,__atomic_load_n( &s->ullCnt,__ATOMIC_RELAXED ) );
+		lines++;
+	}
+	free( buf );
+	fclose( fp );
+	return lines;
+}
+
+void co_profile_reset()
+{
+	if( !g_prof_slots )
+	{
+		return ;
+	}
+	for(int i=0;i<eProfSlots;i++)
+	{
+		__atomic_store_n( &g_prof_slots[i].iState,(int)eSlotEmpty,__ATOMIC_RELEASE );
+	}
+	g_prof_samples = 0;
+	g_prof_dropped = 0;
+}
+
+void co_profile_counts( unsigned long long *samples,unsigned long long *dropped )
+{
+	*samples = __atomic_load_n( &g_prof_samples,__ATOMIC_RELAXED );
+	*dropped = __atomic_load_n( &g_prof_dropped,__ATOMIC_RELAXED );
+}
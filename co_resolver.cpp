@@ -0,0 +1,899 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <string>
+#include <vector>
+#include <map>
+
+//stub resolver: /etc/hosts,then queries to the resolv.conf nameservers over
+//udp ( tcp when truncated ). sockets are waited on with poll,so inside a
+//hooked routine only the routine parks.
+//answers are cached per ttl for the whole process,lookups of the same name
+//in one loop share a single query.
+enum
+{
+	eDnsPort = 53,
+	eDnsMaxServers = 3,
+	eDnsUdpSize = 1232, //edns payload that avoids fragmentation
+	eDnsMaxTtl = 86400,
+	eDnsNegTtl = 30, //NXDOMAIN without a SOA
+	eDnsTypeA = 1,
+	eDnsTypeCname = 5,
+	eDnsTypeSoa = 6,
+	eDnsTypeAaaa = 28,
+	eDnsTypeOpt = 41,
+};
+
+struct stDnsConf_t
+{
+	struct sockaddr_storage servers[ eDnsMaxServers ];
+	socklen_t lens[ eDnsMaxServers ];
+	int iServers;
+	std::vector<std::string> search;
+	int iNdots;
+	int iTimeoutMs; //per try
+	int iAttempts;
+
+	std::multimap<std::string,struct sockaddr_storage> hosts;
+};
+struct stDnsResult_t
+{
+	int iErr; //0,ENOENT for NXDOMAIN,else why the query failed
+	std::vector<struct sockaddr_storage> addrs;
+	unsigned int iTtl;
+};
+struct stDnsCacheEntry_t
+{
+	stDnsResult_t res;
+	unsigned long long ullExpire;
+};
+struct stDnsInflight_t
+{
+	stCoCond_t *cond;
+	bool bDone;
+	int iRef;
+	stDnsResult_t res;
+};
+
+static pthread_mutex_t g_dns_mutex = PTHREAD_MUTEX_INITIALIZER;
+static stDnsConf_t *g_dns_conf = NULL;
+static std::map<std::string,stDnsCacheEntry_t> *g_dns_cache = NULL;
+static __thread std::map<std::string,stDnsInflight_t*> *t_dns_inflight = NULL;
+
+static unsigned long long GetDnsTickMS()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC,&ts );
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool ParseAddr( const char *ip,int port,struct sockaddr_storage *ss,socklen_t *len )
+{
+	memset( ss,0,sizeof(*ss) );
+	struct sockaddr_in *in = (struct sockaddr_in*)ss;
+	struct sockaddr_in6 *in6 = (struct sockaddr_in6*)ss;
+	if( inet_pton( AF_INET,ip,&in->sin_addr ) == 1 )
+	{
+		in->sin_family = AF_INET;
+		in->sin_port = htons( port );
+		*len = sizeof(*in);
+		return true;
+	}
+	if( inet_pton( AF_INET6,ip,&in6->sin6_addr ) == 1 )
+	{
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = htons( port );
+		*len = sizeof(*in6);
+		return true;
+	}
+	return false;
+}
+
+static std::string LowerName( const char *name )
+{
+	std::string s( name );
+	for(size_t i=0;i<s.size();i++)
+	{
+		s[i] = tolower( (unsigned char)s[i] );
+	}
+	if( !s.empty() && s[ s.size() - 1 ] == '.' )
+	{
+		s.erase( s.size() - 1 );
+	}
+	return s;
+}
+
+static void LoadResolvConf( stDnsConf_t *conf )
+{
+	FILE *fp = fopen( "/etc/resolv.conf","r" );
+	char line[ 1024 ];
+	while( fp && fgets( line,sizeof(line),fp ) )
+	{
+		char *save = NULL;
+		char *key = strtok_r( line," \t\r\n",&save );
+		if( !key || key[0] == '#' || key[0] == ';' )
+		{
+			continue;
+		}
+		if( strcmp( key,"nameserver" ) == 0 )
+		{
+			char *ip = strtok_r( NULL," \t\r\n",&save );
+			if( ip && conf->iServers < eDnsMaxServers
+				&& ParseAddr( ip,eDnsPort,conf->servers + conf->iServers,conf->lens + conf->iServers ) )
+			{
+				conf->iServers++;
+			}
+		}
+		else if( strcmp( key,"search" ) == 0 || strcmp( key,"domain" ) == 0 )
+		{
+			conf->search.clear(); //the last one wins
+			for(char *d = strtok_r( NULL," \t\r\n",&save );d;d = strtok_r( NULL," \t\r\n",&save ))
+			{
+				conf->search.push_back( LowerName( d ) );
+			}
+		}
+		else if( strcmp( key,"options" ) == 0 )
+		{
+			for(char *o = strtok_r( NULL," \t\r\n",&save );o;o = strtok_r( NULL," \t\r\n",&save ))
+			{
+				if( strncmp( o,"ndots:",6 ) == 0 ) conf->iNdots = atoi( o + 6 );
+				else if( strncmp( o,"timeout:",8 ) == 0 ) conf->iTimeoutMs = atoi( o + 8 ) * 1000;
+				else if( strncmp( o,"attempts:",9 ) == 0 ) conf->iAttempts = atoi( o + 9 );
+			}
+		}
+	}
+	if( fp )
+	{
+		fclose( fp );
+	}
+	if( !conf->iServers )
+	{
+		ParseAddr( "127.0.0.1",eDnsPort,conf->servers,conf->lens );
+		conf->iServers = 1;
+	}
+}
+static void LoadHosts( stDnsConf_t *conf )
+{
+	FILE *fp = fopen( "/etc/hosts","r" );
+	char line[ 1024 ];
+	while( fp && fgets( line,sizeof(line),fp ) )
+	{
+		char *hash = strchr( line,'#' );
+		if( hash )
+		{
+			*hash = '\0';
+		}
+		char *save = NULL;
+		char *ip = strtok_r( line," \t\r\n",&save );
+		struct sockaddr_storage ss;
+		socklen_t len;
+		if( !ip || !ParseAddr( ip,0,&ss,&len ) )
+		{
+			continue;
+		}
+		for(char *n = strtok_r( NULL," \t\r\n",&save );n;n = strtok_r( NULL," \t\r\n",&save ))
+		{
+			conf->hosts.insert( std::make_pair( LowerName( n ),ss ) );
+		}
+	}
+	if( fp )
+	{
+		fclose( fp );
+	}
+}
+//with g_dns_mutex held
+static stDnsConf_t *GetDnsConf()
+{
+	if( !g_dns_conf )
+	{
+		stDnsConf_t *conf = new stDnsConf_t();
+		conf->iServers = 0;
+		conf->iNdots = 1;
+		conf->iTimeoutMs = 5000;
+		conf->iAttempts = 2;
+		LoadResolvConf( conf );
+		LoadHosts( conf );
+		g_dns_conf = conf;
+		g_dns_cache = new std::map<std::string,stDnsCacheEntry_t>();
+	}
+	return g_dns_conf;
+}
+
+//query packet,return its length
+static int BuildQuery( const std::string &name,int qtype,unsigned short id,unsigned char *buf,int size )
+{
+	if( (int)name.size() + 2 + 16 + 11 > size )
+	{
+		return -1;
+	}
+	memset( buf,0,12 );
+	buf[0] = id >> 8;
+	buf[1] = id & 0xff;
+	buf[2] = 0x01; //RD
+	buf[5] = 1; //QDCOUNT
+	buf[11] = 1; //ARCOUNT: the OPT record
+	int pos = 12;
+	size_t start = 0;
+	while( start < name.size() )
+	{
+		size_t dot = name.find( '.',start );
+		if( dot == std::string::npos )
+		{
+			dot = name.size();
+		}
+		size_t len = dot - start;
+		if( len == 0 || len > 63 )
+		{
+			return -1;
+		}
+		buf[ pos++ ] = len;
+		memcpy( buf + pos,name.data() + start,len );
+		pos += len;
+		start = dot + 1;
+	}
+	buf[ pos++ ] = 0;
+	buf[ pos++ ] = qtype >> 8;
+	buf[ pos++ ] = qtype & 0xff;
+	buf[ pos++ ] = 0;
+	buf[ pos++ ] = 1; //IN
+
+	//OPT: root name,type,udp payload size,rcode/flags,rdlen
+	unsigned char opt[] = { 0,0,eDnsTypeOpt,eDnsUdpSize >> 8,eDnsUdpSize & 0xff,0,0,0,0,0,0 };
+	memcpy( buf + pos,opt,sizeof(opt) );
+	return pos + sizeof(opt);
+}
+
+static int SkipName( const unsigned char *buf,int len,int pos )
+{
+	while( pos < len )
+	{
+		unsigned char c = buf[ pos ];
+		if( c == 0 )
+		{
+			return pos + 1;
+		}
+		if( ( c & 0xc0 ) == 0xc0 )
+		{
+			return pos + 2 <= len ? pos + 2 : -1;
+		}
+		pos += c + 1;
+	}
+	return -1;
+}
+static unsigned int Get16( const unsigned char *p )
+{
+	return ( p[0] << 8 ) | p[1];
+}
+static unsigned int Get32( const unsigned char *p )
+{
+	return ( (unsigned int)p[0] << 24 ) | ( p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+}
+
+//0 with res filled,-1 for a reply that says nothing ( servfail,refused,garbage )
+static int ParseReply( const unsigned char *buf,int len,const unsigned char *query,int qlen,
+		int qtype,stDnsResult_t *res )
+{
+	if( len < 12 || buf[0] != query[0] || buf[1] != query[1] || !( buf[2] & 0x80 ) )
+	{
+		return -1;
+	}
+	//the question must be ours
+	int qend = SkipName( query,qlen,12 ) + 4;
+	if( len < qend || Get16( buf + 4 ) != 1 || memcmp( buf + 12,query + 12,qend - 12 ) != 0 )
+	{
+		return -1;
+	}
+	int rcode = buf[3] & 0x0f;
+	if( rcode != 0 && rcode != 3 )
+	{
+		return -1;
+	}
+	int ancount = Get16( buf + 6 );
+	int nscount = Get16( buf + 8 );
+	int pos = qend;
+	unsigned int ttl = eDnsMaxTtl;
+	unsigned int negttl = eDnsNegTtl;
+	res->addrs.clear();
+	for(int i=0;i<ancount + nscount;i++)
+	{
+		pos = SkipName( buf,len,pos );
+		if( pos < 0 || pos + 10 > len )
+		{
+			return -1;
+		}
+		int type = Get16( buf + pos );
+		unsigned int rttl = Get32( buf + pos + 4 );
+		int rdlen = Get16( buf + pos + 8 );
+		const unsigned char *rdata = buf + pos + 10;
+		pos += 10 + rdlen;
+		if( pos > len )
+		{
+			return -1;
+		}
+		if( i >= ancount )
+		{
+			if( type == eDnsTypeSoa )
+			{
+				//negative ttl is min( soa ttl,soa minimum )
+				int p = SkipName( buf,len,rdata - buf );
+				p = p < 0 ? -1 : SkipName( buf,len,p );
+				if( p > 0 && p + 20 <= len )
+				{
+					unsigned int minimum = Get32( buf + p + 16 );
+					negttl = rttl < minimum ? rttl : minimum;
+				}
+			}
+			continue;
+		}
+		if( type == eDnsTypeCname )
+		{
+			ttl = rttl < ttl ? rttl : ttl;
+			continue;
+		}
+		if( type != qtype )
+		{
+			continue;
+		}
+		struct sockaddr_storage ss;
+		memset( &ss,0,sizeof(ss) );
+		if( type == eDnsTypeA && rdlen == 4 )
+		{
+			struct sockaddr_in *in = (struct sockaddr_in*)&ss;
+			in->sin_family = AF_INET;
+			memcpy( &in->sin_addr,rdata,4 );
+		}
+		else if( type == eDnsTypeAaaa && rdlen == 16 )
+		{
+			struct sockaddr_in6 *in6 = (struct sockaddr_in6*)&ss;
+			in6->sin6_family = AF_INET6;
+			memcpy( &in6->sin6_addr,rdata,16 );
+		}
+		else
+		{
+			continue;
+		}
+		ttl = rttl < ttl ? rttl : ttl;
+		res->addrs.push_back( ss );
+	}
+	res->iErr = rcode == 3 ? ENOENT : 0;
+	res->iTtl = res->addrs.empty() ? ( negttl < eDnsMaxTtl ? negttl : eDnsMaxTtl ) : ttl;
+	return 0;
+}
+
+//timeout_ms left,or -1 with errno ETIMEDOUT / ECANCELED
+static int WaitDns( int fd,short events,unsigned long long end )
+{
+	for(;;)
+	{
+		unsigned long long now = GetDnsTickMS();
+		if( now >= end )
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		struct pollfd pf = { 0 };
+		pf.fd = fd;
+		pf.events = events;
+		int ret = poll( &pf,1,(int)( end - now ) );
+		if( ret > 0 )
+		{
+			return 0;
+		}
+		if( ret < 0 && errno != EINTR )
+		{
+			return -1;
+		}
+		if( ret == 0 && co_deadline_remaining() == 0 )
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+	}
+}
+static int OpenDnsSocket( const struct sockaddr_storage *server,socklen_t slen,int type,unsigned long long end )
+{
+	int fd = socket( server->ss_family,type | SOCK_CLOEXEC,0 );
+	if( fd < 0 )
+	{
+		return -1;
+	}
+	//our own waits,the hooks pass nonblocking fds through
+	fcntl( fd,F_SETFL,fcntl( fd,F_GETFL ) | O_NONBLOCK );
+	if( connect( fd,(const struct sockaddr*)server,slen ) < 0 )
+	{
+		int err = 0;
+		socklen_t len = sizeof(err);
+		if( errno != EINPROGRESS || WaitDns( fd,POLLOUT,end ) < 0
+			|| getsockopt( fd,SOL_SOCKET,SO_ERROR,&err,&len ) < 0 || err )
+		{
+			err = err ? err : errno;
+			close( fd );
+			errno = err;
+			return -1;
+		}
+	}
+	return fd;
+}
+static int TcpIo( int fd,unsigned char *buf,int len,bool out,unsigned long long end )
+{
+	int done = 0;
+	while( done < len )
+	{
+		ssize_t n = out ? write( fd,buf + done,len - done ) : read( fd,buf + done,len - done );
+		if( n > 0 )
+		{
+			done += n;
+			continue;
+		}
+		if( n == 0 )
+		{
+			errno = ECONNRESET;
+			return -1;
+		}
+		if( errno != EAGAIN && errno != EINTR )
+		{
+			return -1;
+		}
+		if( WaitDns( fd,out ? POLLOUT : POLLIN,end ) < 0 )
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+static int QueryTcp( const struct sockaddr_storage *server,socklen_t slen,unsigned char *query,int qlen,
+		int qtype,stDnsResult_t *res,unsigned long long end )
+{
+	int fd = OpenDnsSocket( server,slen,SOCK_STREAM,end );
+	if( fd < 0 )
+	{
+		return -1;
+	}
+	unsigned char hdr[2] = { (unsigned char)( qlen >> 8 ),(unsigned char)( qlen & 0xff ) };
+	std::vector<unsigned char> reply;
+	int ret = -1;
+	if( TcpIo( fd,hdr,2,true,end ) == 0 && TcpIo( fd,query,qlen,true,end ) == 0
+		&& TcpIo( fd,hdr,2,false,end ) == 0 )
+	{
+		reply.resize( Get16( hdr ) );
+		if( !reply.empty() && TcpIo( fd,&reply[0],reply.size(),false,end ) == 0 )
+		{
+			ret = ParseReply( &reply[0],reply.size(),query,qlen,qtype,res );
+			if( ret < 0 )
+			{
+				errno = EIO;
+			}
+		}
+	}
+	int err = errno;
+	close( fd );
+	errno = err;
+	return ret;
+}
+static int QueryServer( const struct sockaddr_storage *server,socklen_t slen,unsigned char *query,int qlen,
+		int qtype,stDnsResult_t *res,unsigned long long end )
+{
+	int fd = OpenDnsSocket( server,slen,SOCK_DGRAM,end );
+	if( fd < 0 )
+	{
+		return -1;
+	}
+	int ret = -1;
+	if( send( fd,query,qlen,0 ) == qlen )
+	{
+		unsigned char buf[ eDnsUdpSize ];
+		//connected,so the kernel drops datagrams from anyone else
+		while( WaitDns( fd,POLLIN,end ) == 0 )
+		{
+			ssize_t n = recv( fd,buf,sizeof(buf),0 );
+			if( n < 0 )
+			{
+				if( errno == EAGAIN || errno == EINTR )
+				{
+					continue;
+				}
+				break; //eg. ECONNREFUSED
+			}
+			if( n >= 3 && ( buf[2] & 0x02 ) && buf[0] == query[0] && buf[1] == query[1] )
+			{
+				close( fd );
+				return QueryTcp( server,slen,query,qlen,qtype,res,end ); //truncated
+			}
+			if( ParseReply( buf,n,query,qlen,qtype,res ) == 0 )
+			{
+				ret = 0;
+				break;
+			}
+			errno = EIO;
+			//a spoofed or broken reply: keep waiting for the real one
+			if( n >= 4 && buf[0] == query[0] && buf[1] == query[1] )
+			{
+				break; //servfail,refused: next server
+			}
+		}
+	}
+	int err = errno;
+	close( fd );
+	errno = err;
+	return ret;
+}
+
+static void Query( const std::string &name,int qtype,stDnsResult_t *res )
+{
+	stDnsConf_t conf_copy;
+	pthread_mutex_lock( &g_dns_mutex );
+	stDnsConf_t *conf = GetDnsConf();
+	memcpy( conf_copy.servers,conf->servers,sizeof(conf->servers) );
+	memcpy( conf_copy.lens,conf->lens,sizeof(conf->lens) );
+	conf_copy.iServers = conf->iServers;
+	conf_copy.iTimeoutMs = conf->iTimeoutMs;
+	conf_copy.iAttempts = conf->iAttempts;
+	pthread_mutex_unlock( &g_dns_mutex );
+
+	static __thread unsigned int seed = 0;
+	if( !seed )
+	{
+		seed = GetDnsTickMS() ^ ( (unsigned long)&seed >> 4 ) ^ getpid();
+	}
+	unsigned char query[ 512 ];
+	int qlen = BuildQuery( name,qtype,rand_r( &seed ) & 0xffff,query,sizeof(query) );
+	if( qlen < 0 )
+	{
+		res->iErr = EINVAL;
+		return ;
+	}
+	res->iErr = ETIMEDOUT;
+	for(int attempt=0;attempt<conf_copy.iAttempts;attempt++)
+	{
+		for(int i=0;i<conf_copy.iServers;i++)
+		{
+			unsigned long long end = GetDnsTickMS() + conf_copy.iTimeoutMs;
+			if( QueryServer( conf_copy.servers + i,conf_copy.lens[i],query,qlen,qtype,res,end ) == 0 )
+			{
+				return ;
+			}
+			res->iErr = errno;
+			if( errno == ECANCELED || co_deadline_remaining() == 0 )
+			{
+				return ;
+			}
+		}
+	}
+}
+
+//cache,then join or lead the in-flight query of this loop
+static void ResolveType( const std::string &name,int qtype,stDnsResult_t *res )
+{
+	char key_prefix[ 16 ];
+	snprintf( key_prefix,sizeof(key_prefix),"%d:",qtype );
+	std::string key = key_prefix + name;
+
+	for(;;)
+	{
+		pthread_mutex_lock( &g_dns_mutex );
+		GetDnsConf();
+		std::map<std::string,stDnsCacheEntry_t>::iterator it = g_dns_cache->find( key );
+		if( it != g_dns_cache->end() )
+		{
+			if( it->second.ullExpire > GetDnsTickMS() )
+			{
+				*res = it->second.res;
+				pthread_mutex_unlock( &g_dns_mutex );
+				return ;
+			}
+			g_dns_cache->erase( it );
+		}
+		pthread_mutex_unlock( &g_dns_mutex );
+
+		if( !t_dns_inflight )
+		{
+			t_dns_inflight = new std::map<std::string,stDnsInflight_t*>();
+		}
+		std::map<std::string,stDnsInflight_t*>::iterator fit = t_dns_inflight->find( key );
+		if( fit == t_dns_inflight->end() )
+		{
+			break;
+		}
+		stDnsInflight_t *wait = fit->second;
+		wait->iRef++;
+		int err = 0;
+		while( !wait->bDone )
+		{
+			if( co_cond_timedwait( wait->cond,-1 ) < 0 && !wait->bDone )
+			{
+				err = errno; //cancelled or past our deadline
+				break;
+			}
+		}
+		bool done = wait->bDone;
+		if( done )
+		{
+			*res = wait->res;
+		}
+		if( --wait->iRef == 0 )
+		{
+			co_cond_free( wait->cond );
+			delete wait;
+		}
+		if( !done )
+		{
+			res->iErr = co_is_cancelled() ? ECANCELED : err;
+			return ;
+		}
+		//the leader was cancelled,not us: try ourselves
+		if( res->iErr != ECANCELED || co_is_cancelled() )
+		{
+			return ;
+		}
+	}
+
+	stDnsInflight_t *wait = new stDnsInflight_t();
+	wait->cond = co_cond_alloc();
+	wait->bDone = false;
+	wait->iRef = 1;
+	( *t_dns_inflight )[ key ] = wait;
+
+	Query( name,qtype,res );
+
+	if( res->iErr == 0 || res->iErr == ENOENT )
+	{
+		pthread_mutex_lock( &g_dns_mutex );
+		if( res->iTtl > 0 )
+		{
+			stDnsCacheEntry_t &e = ( *g_dns_cache )[ key ];
+			e.res = *res;
+			e.ullExpire = GetDnsTickMS() + res->iTtl * 1000ULL;
+		}
+		pthread_mutex_unlock( &g_dns_mutex );
+	}
+	t_dns_inflight->erase( key );
+	wait->res = *res;
+	wait->bDone = true;
+	co_cond_broadcast( wait->cond );
+	if( --wait->iRef == 0 )
+	{
+		co_cond_free( wait->cond );
+		delete wait;
+	}
+}
+
+static int CopyAddrs( const std::vector<struct sockaddr_storage> &v,int family,
+		struct sockaddr_storage *addrs,int cnt,int n )
+{
+	for(size_t i=0;i<v.size() && n<cnt;i++)
+	{
+		if( family == AF_UNSPEC || v[i].ss_family == family )
+		{
+			addrs[ n++ ] = v[i];
+		}
+	}
+	return n;
+}
+
+int co_resolve( const char *name,int family,struct sockaddr_storage *addrs,int cnt )
+{
+	if( !name || !*name || cnt <= 0 || ( family != AF_UNSPEC && family != AF_INET && family != AF_INET6 ) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	struct sockaddr_storage ss;
+	socklen_t len;
+	if( ParseAddr( name,0,&ss,&len ) )
+	{
+		if( family != AF_UNSPEC && family != ss.ss_family )
+		{
+			errno = ENOENT;
+			return -1;
+		}
+		addrs[0] = ss;
+		return 1;
+	}
+	std::string lname = LowerName( name );
+	bool absolute = name[ strlen( name ) - 1 ] == '.';
+
+	std::vector<std::string> candidates;
+	pthread_mutex_lock( &g_dns_mutex );
+	stDnsConf_t *conf = GetDnsConf();
+	std::vector<struct sockaddr_storage> hosts;
+	typedef std::multimap<std::string,struct sockaddr_storage>::iterator hosts_iter;
+	std::pair<hosts_iter,hosts_iter> range = conf->hosts.equal_range( lname );
+	for(hosts_iter it = range.first;it != range.second;++it)
+	{
+		hosts.push_back( it->second );
+	}
+	if( !absolute )
+	{
+		int dots = 0;
+		for(size_t i=0;i<lname.size();i++)
+		{
+			dots += lname[i] == '.';
+		}
+		if( dots >= conf->iNdots )
+		{
+			candidates.push_back( lname );
+		}
+		for(size_t i=0;i<conf->search.size();i++)
+		{
+			candidates.push_back( lname + "." + conf->search[i] );
+		}
+		if( dots < conf->iNdots )
+		{
+			candidates.push_back( lname );
+		}
+	}
+	else
+	{
+		candidates.push_back( lname );
+	}
+	pthread_mutex_unlock( &g_dns_mutex );
+
+	int n = CopyAddrs( hosts,family,addrs,cnt,0 );
+	if( n > 0 )
+	{
+		return n;
+	}
+	int err = ENOENT;
+	for(size_t i=0;i<candidates.size();i++)
+	{
+		//A first: v6 often resolves where it does not route
+		int types[2] = { eDnsTypeA,eDnsTypeAaaa };
+		bool nx = true;
+		for(int t=0;t<2;t++)
+		{
+			if( ( types[t] == eDnsTypeA && family == AF_INET6 ) || ( types[t] == eDnsTypeAaaa && family == AF_INET ) )
+			{
+				continue;
+			}
+			stDnsResult_t res;
+			ResolveType( candidates[i],types[t],&res );
+			if( res.iErr == 0 )
+			{
+				nx = false;
+				n = CopyAddrs( res.addrs,family,addrs,cnt,n );
+			}
+			else if( res.iErr != ENOENT )
+			{
+				nx = false;
+				err = res.iErr;
+				if( err == ECANCELED )
+				{
+					errno = err;
+					return -1;
+				}
+			}
+		}
+		if( n > 0 )
+		{
+			return n;
+		}
+		if( !nx && err == ENOENT )
+		{
+			err = ENODATA; //the name exists without such addresses
+		}
+	}
+	errno = err;
+	return -1;
+}
+
+int co_resolver_set_nameserver( const char *ip,int port )
+{
+	struct sockaddr_storage ss;
+	socklen_t len;
+	if( !ip || port <= 0 || port > 65535 || !ParseAddr( ip,port,&ss,&len ) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock( &g_dns_mutex );
+	stDnsConf_t *conf = GetDnsConf();
+	conf->servers[0] = ss;
+	conf->lens[0] = len;
+	conf->iServers = 1;
+	g_dns_cache->clear();
+	pthread_mutex_unlock( &g_dns_mutex );
+	return 0;
+}
+
+void co_resolver_flush()
+{
+	pthread_mutex_lock( &g_dns_mutex );
+	if( g_dns_cache )
+	{
+		g_dns_cache->clear();
+	}
+	pthread_mutex_unlock( &g_dns_mutex );
+}
+
+//builds the list from numeric getaddrinfo calls,so glibc freeaddrinfo frees it
+int co_getaddrinfo( const char *node,const char *service,const struct addrinfo *hints,struct addrinfo **res )
+{
+	int family = hints ? hints->ai_family : AF_UNSPEC;
+	struct sockaddr_storage addrs[ 32 ];
+	int n = co_resolve( node,family,addrs,sizeof(addrs) / sizeof(addrs[0]) );
+	if( n < 0 )
+	{
+		switch( errno )
+		{
+			case ENOENT: return EAI_NONAME;
+			case ENODATA: return EAI_NODATA;
+			case EINVAL: return family == AF_UNSPEC || family == AF_INET || family == AF_INET6 ? EAI_NONAME : EAI_FAMILY;
+			case ETIMEDOUT:
+			case ECANCELED: return EAI_AGAIN;
+		}
+		return EAI_FAIL;
+	}
+	struct addrinfo h;
+	memset( &h,0,sizeof(h) );
+	if( hints )
+	{
+		h = *hints;
+	}
+	h.ai_flags = ( h.ai_flags & ~( AI_CANONNAME | AI_ADDRCONFIG ) ) | AI_NUMERICHOST;
+
+	struct addrinfo *head = NULL;
+	struct addrinfo **tail = &head;
+	for(int i=0;i<n;i++)
+	{
+		char ip[ INET6_ADDRSTRLEN ];
+		const void *src = addrs[i].ss_family == AF_INET
+			? (const void*)&( (struct sockaddr_in*)( addrs + i ) )->sin_addr
+			: (const void*)&( (struct sockaddr_in6*)( addrs + i ) )->sin6_addr;
+		inet_ntop( addrs[i].ss_family,src,ip,sizeof(ip) );
+		h.ai_family = addrs[i].ss_family;
+
+		struct addrinfo *r = NULL;
+		int ret = getaddrinfo( ip,service,&h,&r );
+		if( ret != 0 )
+		{
+			if( head )
+			{
+				freeaddrinfo( head );
+			}
+			return ret;
+		}
+		*tail = r;
+		while( *tail )
+		{
+			tail = &( *tail )->ai_next;
+		}
+	}
+	if( head && hints && ( hints->ai_flags & AI_CANONNAME ) )
+	{
+		head->ai_canonname = strdup( node );
+	}
+	*res = head;
+	return head ? 0 : EAI_NONAME;
+}
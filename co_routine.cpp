@@ -19,6 +19,7 @@
 #include "co_routine.h"
 #include "co_routine_inner.h"
 #include "co_epoll.h"
+#include "co_probe.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -37,6 +38,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/syscall.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <limits.h>
 
@@ -48,16 +50,6 @@ using namespace std;
 stCoRoutine_t *GetCurrCo( stCoRoutineEnv_t *env );
 struct stCoEpoll_t;
 
-struct stCoRoutineEnv_t
-{
-	stCoRoutine_t *pCallStack[ 128 ];
-	int iCallStackSize;
-	stCoEpoll_t *pEpoll;
-
-	//for copy stack log lastco and nextco
-	stCoRoutine_t* pending_co;
-	stCoRoutine_t* occupy_co;
-};
 //int socket(int domain, int type, int protocol);
 void co_log_err( const char *fmt,... )
 {
@@ -99,6 +91,30 @@ static unsigned long long getCpuKhz()
 }
 #endif
 
+#if defined( __LIBCO_STAT__ )
+static inline unsigned long long GetCycles()
+{
+#if defined( __x86_64__ ) || defined( __i386__ )
+	uint32_t lo, hi;
+	__asm__ __volatile__ ( "rdtsc" : "=a"(lo), "=d"(hi) );
+	return ((unsigned long long)hi << 32) | lo;
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC,&ts );
+	return (unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+#endif
+
+static unsigned long long GetTickUS()
+{
+	struct timeval now = { 0 };
+	gettimeofday( &now,NULL );
+	unsigned long long u = now.tv_sec;
+	u *= 1000 * 1000;
+	u += now.tv_usec;
+	return u;
+}
 static unsigned long long GetTickMS()
 {
 #if defined( __LIBCO_RDTSCP__) 
@@ -269,9 +285,18 @@ void inline Join( TLink*apLink,TLink *apOther )
 stStackMem_t* co_alloc_stackmem(unsigned int stack_size)
 {
 	stStackMem_t* stack_mem = (stStackMem_t*)malloc(sizeof(stStackMem_t));
+	if( !stack_mem )
+	{
+		return NULL;
+	}
 	stack_mem->occupy_co= NULL;
 	stack_mem->stack_size = stack_size;
 	stack_mem->stack_buffer = (char*)malloc(stack_size);
+	if( !stack_mem->stack_buffer )
+	{
+		free( stack_mem );
+		return NULL;
+	}
 	stack_mem->stack_bp = stack_mem->stack_buffer + stack_size;
 	return stack_mem;
 }
@@ -322,6 +347,7 @@ struct stCoEpoll_t
 
 	co_epoll_res *result; 
 
+	stCoEpollStat_t stStat;
 };
 typedef void (*OnPreparePfn_t)( stTimeoutItem_t *,struct epoll_event &ev, stTimeoutItemLink_t *active );
 typedef void (*OnProcessPfn_t)( stTimeoutItem_t *);
@@ -441,12 +467,14 @@ inline void TakeAllTimeout( stTimeout_t *apTimeout,unsigned long long allNow,stT
 
 
 }
+static void ClearSpecific( stCoRoutine_t *co );
 static int CoRoutineFunc( stCoRoutine_t *co,void * )
 {
 	if( co->pfn )
 	{
 		co->pfn( co->arg );
 	}
+	ClearSpecific( co );
 	co->cEnd = 1;
 
 	stCoRoutineEnv_t *env = co->env;
@@ -483,14 +511,12 @@ struct stCoRoutine_t *co_create_env( stCoRoutineEnv_t * env, const stCoRoutineAt
 	}
 
 	stCoRoutine_t *lp = (stCoRoutine_t*)malloc( sizeof(stCoRoutine_t) );
-	
+	if( !lp )
+	{
+		return NULL;
+	}
 	memset( lp,0,(long)(sizeof(stCoRoutine_t))); 
 
-
-	lp->env = env;
-	lp->pfn = pfn;
-	lp->arg = arg;
-
 	stStackMem_t* stack_mem = NULL;
 	if( at.share_stack )
 	{
@@ -500,6 +526,29 @@ struct stCoRoutine_t *co_create_env( stCoRoutineEnv_t * env, const stCoRoutineAt
 	else
 	{
 		stack_mem = co_alloc_stackmem(at.stack_size);
+		if( !stack_mem )
+		{
+			free( lp );
+			return NULL;
+		}
+	}
+
+
+	lp->env = env;
+	lp->pfn = pfn;
+	lp->arg = arg;
+
+	static unsigned long long s_ullCoId = 0;
+	lp->ullId = __sync_add_and_fetch( &s_ullCoId,1 );
+	lp->iWaitFd = -1;
+	AddTail( &env->stLiveList,lp );
+#if defined( __LIBCO_STAT__ )
+	lp->ullSwitchCycles = GetCycles();
+#endif
+
+	if( env->iCallStackSize > 0 )
+	{
+		lp->ullDeadline = GetCurrCo( env )->ullDeadline;
 	}
 	lp->stack_mem = stack_mem;
 
@@ -511,10 +560,12 @@ struct stCoRoutine_t *co_create_env( stCoRoutineEnv_t * env, const stCoRoutineAt
 	lp->cIsMain = 0;
 	lp->cEnableSysHook = 0;
 	lp->cIsShareStack = at.share_stack != NULL;
+	lp->cCancel = 0;
 
 	lp->save_size = 0;
 	lp->save_buffer = NULL;
 
+	CO_PROBE2( create,lp->ullId,lp->pfn );
 	return lp;
 }
 
@@ -525,11 +576,22 @@ int co_create( stCoRoutine_t **ppco,const stCoRoutineAttr_t *attr,pfn_co_routine
 		co_init_curr_thread_env();
 	}
 	stCoRoutine_t *co = co_create_env( co_get_curr_thread_env(), attr, pfn,arg );
+	if( !co )
+	{
+		errno = ENOMEM;
+		return -1;
+	}
 	*ppco = co;
 	return 0;
 }
+static void DetachGroups( stCoRoutine_t *co );
 void co_free( stCoRoutine_t *co )
 {
+	RemoveFromLink<stCoRoutine_t,stCoRoutineLink_t>( co );
+	ClearSpecific( co );
+	DetachGroups( co );
+	free( co->stSpec.pExtra );
+
     if (!co->cIsShareStack) 
     {    
         free(co->stack_mem->stack_buffer);
@@ -565,6 +627,7 @@ void co_resume( stCoRoutine_t *co )
 		co->cStart = 1;
 	}
 	env->pCallStack[ env->iCallStackSize++ ] = co;
+	CO_PROBE2( resume,lpCurrRoutine->ullId,co->ullId );
 	co_swap( lpCurrRoutine, co );
 
 
@@ -578,8 +641,14 @@ void co_reset(stCoRoutine_t * co)
     if(!co->cStart || co->cIsMain)
         return;
 
+    ClearSpecific( co );
+    DetachGroups( co );
+
     co->cStart = 0;
     co->cEnd = 0;
+    co->cCancel = 0;
+    co->ullDeadline = 0;
+    co->pszTag = NULL;
 
     // 如果当前协程有共享栈被切出的buff，要进行释放
     if(co->save_buffer)
@@ -602,6 +671,7 @@ void co_yield_env( stCoRoutineEnv_t *env )
 
 	env->iCallStackSize--;
 
+	CO_PROBE2( yield,curr->ullId,last->ullId );
 	co_swap( curr, last);
 }
 
@@ -630,6 +700,7 @@ void save_stack_buffer(stCoRoutine_t* occupy_co)
 	occupy_co->save_size = len;
 
 	memcpy(occupy_co->save_buffer, occupy_co->stack_sp, len);
+	CO_PROBE2( stack_save,occupy_co->ullId,len );
 }
 
 void co_swap(stCoRoutine_t* curr, stCoRoutine_t* pending_co)
@@ -660,6 +731,22 @@ void co_swap(stCoRoutine_t* curr, stCoRoutine_t* pending_co)
 		}
 	}
 
+	__atomic_store_n( &env->ullHeartbeat,env->ullHeartbeat + 1,__ATOMIC_RELAXED );
+
+#if defined( __LIBCO_STAT__ )
+	unsigned long long cycles = GetCycles();
+	curr->ullRunCycles += cycles - curr->ullSwitchCycles;
+	curr->ullSwitchCycles = cycles;
+	if( pending_co->cWaitReason != CO_WAIT_NONE )
+	{
+		pending_co->ullBlockCycles += cycles - pending_co->ullSwitchCycles;
+	}
+	pending_co->ullSwitchCycles = cycles;
+	pending_co->ullResumeCnt++;
+#endif
+
+	CO_TRACE( CO_TRACE_SWITCH,curr->ullId,NULL,(long)pending_co->ullId,0 );
+
 	//swap context
 	coctx_swap(&(curr->ctx),&(pending_co->ctx) );
 
@@ -674,6 +761,7 @@ void co_swap(stCoRoutine_t* curr, stCoRoutine_t* pending_co)
 		if (update_pending_co->save_buffer && update_pending_co->save_size > 0)
 		{
 			memcpy(update_pending_co->stack_sp, update_pending_co->save_buffer, update_pending_co->save_size);
+			CO_PROBE2( stack_restore,update_pending_co->ullId,update_pending_co->save_size );
 		}
 	}
 }
@@ -753,6 +841,20 @@ void co_init_curr_thread_env()
 
 	coctx_init( &self->ctx );
 
+	//main routine runs on the thread stack,record it for unwinders
+	pthread_attr_t attr;
+	if( pthread_getattr_np( pthread_self(),&attr ) == 0 )
+	{
+		void *stack_addr = NULL;
+		size_t stack_size = 0;
+		if( pthread_attr_getstack( &attr,&stack_addr,&stack_size ) == 0 )
+		{
+			self->ctx.ss_sp = (char*)stack_addr;
+			self->ctx.ss_size = stack_size;
+		}
+		pthread_attr_destroy( &attr );
+	}
+
 	env->pCallStack[ env->iCallStackSize++ ] = self;
 
 	stCoEpoll_t *ev = AllocEpoll();
@@ -790,6 +892,47 @@ void OnPollPreparePfn( stTimeoutItem_t * ap,struct epoll_event &e,stTimeoutItemL
 }
 
 
+//single writer,so relaxed load + store is enough for lock-free readers
+static inline void StatAdd( unsigned long long *p,unsigned long long v )
+{
+	__atomic_store_n( p,*p + v,__ATOMIC_RELAXED );
+}
+static inline void HistAdd( stCoHistogram_t *h,unsigned long long v )
+{
+	int idx = v ? 64 - __builtin_clzll( v ) : 0;
+	if( idx >= stCoHistogram_t::eBucketCnt )
+	{
+		idx = stCoHistogram_t::eBucketCnt - 1;
+	}
+	StatAdd( h->aBucket + idx,1 );
+	StatAdd( &h->ullCnt,1 );
+	StatAdd( &h->ullSum,v );
+	if( v > h->ullMax )
+	{
+		__atomic_store_n( &h->ullMax,v,__ATOMIC_RELAXED );
+	}
+}
+static void HistRead( const stCoHistogram_t *h,stCoHistogram_t *out )
+{
+	out->ullCnt = __atomic_load_n( &h->ullCnt,__ATOMIC_RELAXED );
+	out->ullSum = __atomic_load_n( &h->ullSum,__ATOMIC_RELAXED );
+	out->ullMax = __atomic_load_n( &h->ullMax,__ATOMIC_RELAXED );
+	for(int i=0;i<stCoHistogram_t::eBucketCnt;i++)
+	{
+		out->aBucket[i] = __atomic_load_n( h->aBucket + i,__ATOMIC_RELAXED );
+	}
+}
+void co_read_epoll_stat( stCoEpoll_t *ctx,stCoEpollStat_t *stat )
+{
+	const stCoEpollStat_t *s = &ctx->stStat;
+	stat->ullLoopCnt = __atomic_load_n( &s->ullLoopCnt,__ATOMIC_RELAXED );
+	HistRead( &s->stEvents,&stat->stEvents );
+	HistRead( &s->stTimeouts,&stat->stTimeouts );
+	HistRead( &s->stActive,&stat->stActive );
+	HistRead( &s->stRunUs,&stat->stRunUs );
+	HistRead( &s->stLatenessMs,&stat->stLatenessMs );
+}
+
 void co_eventloop( stCoEpoll_t *ctx,pfn_co_eventloop_t pfn,void *arg )
 {
 	if( !ctx->result )
@@ -797,12 +940,22 @@ void co_eventloop( stCoEpoll_t *ctx,pfn_co_eventloop_t pfn,void *arg )
 		ctx->result =  co_epoll_res_alloc( stCoEpoll_t::_EPOLL_SIZE );
 	}
 	co_epoll_res *result = ctx->result;
+	stCoRoutineEnv_t *env = co_get_curr_thread_env();
 
+	co_watchdog_add_env( env );
 
 	for(;;)
 	{
+		co_uring_flush();
+
 		int ret = co_epoll_wait( ctx->iEpollFd,result,stCoEpoll_t::_EPOLL_SIZE, 1 );
 
+		__atomic_store_n( &env->ullHeartbeat,env->ullHeartbeat + 1,__ATOMIC_RELAXED );
+		if( ret > 0 )
+		{
+			CO_TRACE( CO_TRACE_WAKE,0,"epoll_wake",ret,0 );
+		}
+
 		stTimeoutItemLink_t *active = (ctx->pstActiveList);
 		stTimeoutItemLink_t *timeout = (ctx->pstTimeoutList);
 
@@ -835,6 +988,11 @@ void co_eventloop( stCoEpoll_t *ctx,pfn_co_eventloop_t pfn,void *arg )
 
 		Join<stTimeoutItem_t,stTimeoutItemLink_t>( active,timeout );
 
+		stCoEpollStat_t *stat = &ctx->stStat;
+		unsigned long long begin = GetTickUS();
+		int active_cnt = 0;
+		int timeout_cnt = 0;
+
 		lp = active->head;
 		while( lp )
 		{
@@ -850,6 +1008,15 @@ void co_eventloop( stCoEpoll_t *ctx,pfn_co_eventloop_t pfn,void *arg )
 					continue;
 				}
 			}
+			if( lp->bTimeout )
+			{
+				unsigned long long run = GetTickMS();
+				HistAdd( &stat->stLatenessMs,run > lp->ullExpireTime ? run - lp->ullExpireTime : 0 );
+				CO_PROBE3( timer_fire,lp,lp->ullExpireTime,run );
+				CO_TRACE( CO_TRACE_TIMER,0,"timer_fire",(long)( run > lp->ullExpireTime ? run - lp->ullExpireTime : 0 ),0 );
+				timeout_cnt++;
+			}
+			active_cnt++;
 			if( lp->pfnProcess )
 			{
 				lp->pfnProcess( lp );
@@ -857,6 +1024,15 @@ void co_eventloop( stCoEpoll_t *ctx,pfn_co_eventloop_t pfn,void *arg )
 
 			lp = active->head;
 		}
+
+		co_zerocopy_reap();
+
+		StatAdd( &stat->ullLoopCnt,1 );
+		HistAdd( &stat->stEvents,ret > 0 ? ret : 0 );
+		HistAdd( &stat->stTimeouts,timeout_cnt );
+		HistAdd( &stat->stActive,active_cnt );
+		HistAdd( &stat->stRunUs,GetTickUS() - begin );
+
 		if( pfn )
 		{
 			if( -1 == pfn( arg ) )
@@ -866,6 +1042,7 @@ void co_eventloop( stCoEpoll_t *ctx,pfn_co_eventloop_t pfn,void *arg )
 		}
 
 	}
+	co_watchdog_del_env( env );
 }
 void OnCoroutineEvent( stTimeoutItem_t * ap )
 {
@@ -913,19 +1090,48 @@ stCoRoutine_t *GetCurrThreadCo( )
 
 
 
+static int GetDeadlineRemain( stCoRoutine_t *co )
+{
+	if( !co || !co->ullDeadline )
+	{
+		return -1;
+	}
+	unsigned long long now = GetTickMS();
+	if( now >= co->ullDeadline )
+	{
+		return 0;
+	}
+	unsigned long long remain = co->ullDeadline - now;
+	return remain > INT_MAX ? INT_MAX : (int)remain;
+}
+
 typedef int (*poll_pfn_t)(struct pollfd fds[], nfds_t nfds, int timeout);
 int co_poll_inner( stCoEpoll_t *ctx,struct pollfd fds[], nfds_t nfds, int timeout, poll_pfn_t pollfunc)
 {
+	stCoRoutine_t* self = co_self();
+	int remain = GetDeadlineRemain( self );
+	if( 0 == remain )
+	{
+		timeout = 0;
+	}
     if (timeout == 0)
 	{
-		return pollfunc(fds, nfds, timeout);
+		return pollfunc ? pollfunc(fds, nfds, timeout) : poll(fds, nfds, timeout);
 	}
 	if (timeout < 0)
 	{
 		timeout = INT_MAX;
 	}
+	if( remain > 0 && remain < timeout )
+	{
+		timeout = remain;
+	}
 	int epfd = ctx->iEpollFd;
-	stCoRoutine_t* self = co_self();
+	if( self->cCancel )
+	{
+		errno = ECANCELED;
+		return -1;
+	}
 
 	//1.struct change
 	stPoll_t& arg = *((stPoll_t*)malloc(sizeof(stPoll_t)));
@@ -996,8 +1202,21 @@ int co_poll_inner( stCoEpoll_t *ctx,struct pollfd fds[], nfds_t nfds, int timeou
 	}
     else
 	{
+		self->pWaitItem = &arg;
+		self->cWaitReason = nfds ? CO_WAIT_FD : CO_WAIT_TIMER;
+		self->iWaitFd = nfds ? fds[0].fd : -1;
+		CO_PROBE5( poll_park,self->ullId,self->iWaitFd,nfds,timeout,now );
 		co_yield_env( co_get_curr_thread_env() );
+		CO_PROBE4( poll_wake,self->ullId,self->iWaitFd,arg.iRaiseCnt,now );
+		self->pWaitItem = NULL;
+		self->cWaitReason = CO_WAIT_NONE;
+		self->iWaitFd = -1;
 		iRaiseCnt = arg.iRaiseCnt;
+		if( self->cCancel )
+		{
+			errno = ECANCELED;
+			iRaiseCnt = -1;
+		}
 	}
 
     {
@@ -1044,6 +1263,67 @@ stCoEpoll_t *co_get_epoll_ct()
 	}
 	return co_get_curr_thread_env()->pEpoll;
 }
+//wakeup: an eventfd in the loop's epoll,any thread may signal it
+struct stCoWakeup_t
+{
+	stTimeoutItem_t item;
+	stCoEpoll_t *ctx;
+	int fd;
+	pfn_co_wakeup_t pfn;
+	void *arg;
+};
+static void OnWakeupProcess( stTimeoutItem_t *ap )
+{
+	stCoWakeup_t *w = (stCoWakeup_t*)ap->pArg;
+	eventfd_t cnt;
+	eventfd_read( w->fd,&cnt );
+	w->pfn( w->arg );
+}
+stCoWakeup_t *co_wakeup_alloc( stCoEpoll_t *ctx,pfn_co_wakeup_t pfn,void *arg )
+{
+	stCoWakeup_t *w = (stCoWakeup_t*)calloc( 1,sizeof(stCoWakeup_t) );
+	w->fd = eventfd( 0,EFD_NONBLOCK | EFD_CLOEXEC );
+	if( w->fd < 0 )
+	{
+		free( w );
+		return NULL;
+	}
+	w->ctx = ctx;
+	w->pfn = pfn;
+	w->arg = arg;
+	w->item.pfnProcess = OnWakeupProcess;
+	w->item.pArg = w;
+
+	struct epoll_event ev;
+	memset( &ev,0,sizeof(ev) );
+	ev.events = EPOLLIN;
+	ev.data.ptr = &w->item;
+	if( co_epoll_ctl( ctx->iEpollFd,EPOLL_CTL_ADD,w->fd,&ev ) < 0 )
+	{
+		close( w->fd );
+		free( w );
+		return NULL;
+	}
+	return w;
+}
+int co_wakeup_fd( stCoWakeup_t *w )
+{
+	return w->fd;
+}
+void co_wakeup_signal( stCoWakeup_t *w )
+{
+	eventfd_write( w->fd,1 );
+}
+void co_wakeup_free( stCoWakeup_t *w )
+{
+	struct epoll_event ev;
+	memset( &ev,0,sizeof(ev) );
+	co_epoll_ctl( w->ctx->iEpollFd,EPOLL_CTL_DEL,w->fd,&ev );
+	RemoveFromLink<stTimeoutItem_t,stTimeoutItemLink_t>( &w->item );
+	close( w->fd );
+	free( w );
+}
+
 struct stHookPThreadSpec_t
 {
 	stCoRoutine_t *co;
@@ -1054,6 +1334,39 @@ struct stHookPThreadSpec_t
 		size = 1024
 	};
 };
+static stCoSpec_t *FindSpec( stCoSpecTable_t *tab,pthread_key_t key,int *pos )
+{
+	for(int i=0;i<tab->iInlineCnt;i++)
+	{
+		if( tab->aInline[i].key == key )
+		{
+			return tab->aInline + i;
+		}
+	}
+	int lo = 0;
+	int hi = tab->iExtraCnt;
+	while( lo < hi )
+	{
+		int mid = ( lo + hi ) / 2;
+		if( tab->pExtra[ mid ].key < key )
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	if( pos )
+	{
+		*pos = lo;
+	}
+	if( lo < tab->iExtraCnt && tab->pExtra[ lo ].key == key )
+	{
+		return tab->pExtra + lo;
+	}
+	return NULL;
+}
 void *co_getspecific(pthread_key_t key)
 {
 	stCoRoutine_t *co = GetCurrThreadCo();
@@ -1061,7 +1374,53 @@ void *co_getspecific(pthread_key_t key)
 	{
 		return pthread_getspecific( key );
 	}
-	return co->aSpec[ key ].value;
+	stCoSpec_t *spec = FindSpec( &co->stSpec,key,NULL );
+	return spec ? spec->value : NULL;
+}
+static int SetSpecific( stCoRoutine_t *co,pthread_key_t key,const void *value,
+		void (*destructor)(void*),bool set_destructor )
+{
+	stCoSpecTable_t *tab = &co->stSpec;
+	int pos = 0;
+	stCoSpec_t *spec = FindSpec( tab,key,&pos );
+	if( spec )
+	{
+		spec->value = (void*)value;
+		if( set_destructor )
+		{
+			spec->pfnDestructor = destructor;
+		}
+		return 0;
+	}
+	if( !value )
+	{
+		return 0;
+	}
+	if( tab->iInlineCnt < stCoSpecTable_t::eInlineSize )
+	{
+		spec = tab->aInline + tab->iInlineCnt++;
+		spec->key = key;
+		spec->value = (void*)value;
+		spec->pfnDestructor = destructor;
+		return 0;
+	}
+	if( tab->iExtraCnt == tab->iExtraCap )
+	{
+		int cap = tab->iExtraCap ? tab->iExtraCap * 2 : 8;
+		stCoSpec_t *extra = (stCoSpec_t*)realloc( tab->pExtra,sizeof(stCoSpec_t) * cap );
+		if( !extra )
+		{
+			return ENOMEM;
+		}
+		tab->pExtra = extra;
+		tab->iExtraCap = cap;
+	}
+	memmove( tab->pExtra + pos + 1,tab->pExtra + pos,sizeof(stCoSpec_t) * ( tab->iExtraCnt - pos ) );
+	tab->pExtra[ pos ].key = key;
+	tab->pExtra[ pos ].value = (void*)value;
+	tab->pExtra[ pos ].pfnDestructor = destructor;
+	tab->iExtraCnt++;
+	return 0;
 }
 int co_setspecific(pthread_key_t key, const void *value)
 {
@@ -1070,8 +1429,50 @@ int co_setspecific(pthread_key_t key, const void *value)
 	{
 		return pthread_setspecific( key,value );
 	}
-	co->aSpec[ key ].value = (void*)value;
-	return 0;
+	return SetSpecific( co,key,value,NULL,false );
+}
+int co_setspecific_dtor( pthread_key_t key, const void *value,void (*destructor)(void*) )
+{
+	stCoRoutine_t *co = GetCurrThreadCo();
+	if( !co || co->cIsMain )
+	{
+		return pthread_setspecific( key,value );
+	}
+	return SetSpecific( co,key,value,destructor,true );
+}
+static int RunSpecDestructor( stCoSpec_t *spec )
+{
+	if( !spec->value || !spec->pfnDestructor )
+	{
+		return 0;
+	}
+	void *value = spec->value;
+	spec->value = NULL;
+	spec->pfnDestructor( value );
+	return 1;
+}
+static void ClearSpecific( stCoRoutine_t *co )
+{
+	stCoSpecTable_t *tab = &co->stSpec;
+	//destructors may set specific again,like PTHREAD_DESTRUCTOR_ITERATIONS
+	for(int round = 0;round < 4;round++)
+	{
+		int called = 0;
+		for(int i=0;i<tab->iInlineCnt;i++)
+		{
+			called += RunSpecDestructor( tab->aInline + i );
+		}
+		for(int i=0;i<tab->iExtraCnt;i++)
+		{
+			called += RunSpecDestructor( tab->pExtra + i );
+		}
+		if( !called )
+		{
+			break;
+		}
+	}
+	tab->iInlineCnt = 0;
+	tab->iExtraCnt = 0;
 }
 
 
@@ -1095,6 +1496,52 @@ stCoRoutine_t *co_self()
 	return GetCurrThreadCo();
 }
 
+int co_get_stat( stCoRoutine_t *co,stCoRoutineStat_t *stat )
+{
+	memset( stat,0,sizeof(*stat) );
+	stat->ullId = co->ullId;
+	stat->iWaitReason = co->cWaitReason;
+	stat->iWaitFd = co->iWaitFd;
+#if defined( __LIBCO_STAT__ )
+	stat->ullResumeCnt = co->ullResumeCnt;
+	stat->ullRunCycles = co->ullRunCycles;
+	stat->ullBlockCycles = co->ullBlockCycles;
+	if( co->cWaitReason != CO_WAIT_NONE )
+	{
+		stat->ullBlockCycles += GetCycles() - co->ullSwitchCycles;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+void co_foreach_ct( pfn_co_foreach_t pfn,void *arg )
+{
+	stCoRoutineEnv_t *env = co_get_curr_thread_env();
+	if( !env )
+	{
+		return ;
+	}
+	for( stCoRoutine_t *co = env->stLiveList.head;co;co = co->pNext )
+	{
+		pfn( co,arg );
+	}
+}
+
+void co_set_deadline( int timeout_ms )
+{
+	stCoRoutine_t *co = GetCurrThreadCo();
+	if( !co )
+	{
+		return ;
+	}
+	co->ullDeadline = timeout_ms < 0 ? 0 : GetTickMS() + timeout_ms;
+}
+int co_deadline_remaining()
+{
+	return GetDeadlineRemain( GetCurrThreadCo() );
+}
+
 //co cond
 struct stCoCond_t;
 struct stCoCondItem_t 
@@ -1146,10 +1593,26 @@ int co_cond_broadcast( stCoCond_t *si )
 }
 
 
-int co_cond_timedwait( stCoCond_t *link,int ms )
+static int CondTimedWait( stCoCond_t *link,int ms,char reason )
 {
+	stCoRoutine_t *self = GetCurrThreadCo();
+	if( self->cCancel )
+	{
+		errno = ECANCELED;
+		return -1;
+	}
+	int remain = GetDeadlineRemain( self );
+	if( 0 == remain )
+	{
+		errno = ETIMEDOUT;
+		return -1;
+	}
+	if( remain > 0 && ( ms <= 0 || remain < ms ) )
+	{
+		ms = remain;
+	}
 	stCoCondItem_t* psi = (stCoCondItem_t*)calloc(1, sizeof(stCoCondItem_t));
-	psi->timeout.pArg = GetCurrThreadCo();
+	psi->timeout.pArg = self;
 	psi->timeout.pfnProcess = OnSignalProcessEvent;
 
 	if( ms > 0 )
@@ -1166,14 +1629,33 @@ int co_cond_timedwait( stCoCond_t *link,int ms )
 	}
 	AddTail( link, psi);
 
+	self->pWaitItem = &psi->timeout;
+	self->cWaitReason = reason;
 	co_yield_ct();
+	self->pWaitItem = NULL;
+	self->cWaitReason = CO_WAIT_NONE;
 
 
 	RemoveFromLink<stCoCondItem_t,stCoCond_t>( psi );
+	bool timedout = psi->timeout.bTimeout;
 	free(psi);
 
+	if( self->cCancel )
+	{
+		errno = ECANCELED;
+		return -1;
+	}
+	if( timedout && 0 == GetDeadlineRemain( self ) )
+	{
+		errno = ETIMEDOUT; //the deadline ran out,not only ms
+		return -1;
+	}
 	return 0;
 }
+int co_cond_timedwait( stCoCond_t *link,int ms )
+{
+	return CondTimedWait( link,ms,CO_WAIT_COND );
+}
 stCoCond_t *co_cond_alloc()
 {
 	return (stCoCond_t*)calloc( 1,sizeof(stCoCond_t) );
@@ -1194,3 +1676,289 @@ stCoCondItem_t *co_cond_pop( stCoCond_t *link )
 	}
 	return p;
 }
+
+
+//co task group
+struct stCoTask_t
+{
+	stCoTaskGroup_t *group; //NULL while detached
+	stCoRoutine_t *co;
+
+	pfn_co_routine_t pfn;
+	void *arg;
+	void *result;
+	char cDone;
+
+	stTimeoutItem_t release;
+};
+struct stCoTaskGroup_t
+{
+	stCoRoutineAttr_t attr;
+	stCoCond_t *cond;
+
+	stCoRoutine_t *owner;
+	stCoTaskGroup_t *pNextGroup; //in owner->pGroups
+	char cCancel;
+
+	stCoTask_t **pTasks;
+	int iTaskCnt;
+	int iTaskCap;
+	int iDoneCnt;
+};
+static void OnTaskReleaseEvent( stTimeoutItem_t *ap )
+{
+	stCoTask_t *task = (stCoTask_t*)ap->pArg;
+	co_release( task->co );
+	free( task );
+}
+static void *TaskRoutineFunc( void *arg )
+{
+	stCoTask_t *task = (stCoTask_t*)arg;
+	task->result = task->pfn( task->arg );
+	task->cDone = 1;
+
+	stCoTaskGroup_t *group = task->group;
+	if( group )
+	{
+		group->iDoneCnt++;
+		co_cond_broadcast( group->cond );
+	}
+	else
+	{
+		//group has gone,we can not free our own stack here,
+		//so let the eventloop release us after we yield.
+		AddTail( co_get_curr_thread_env()->pEpoll->pstActiveList,&task->release );
+	}
+	return task->result;
+}
+stCoTaskGroup_t *co_group_alloc( const stCoRoutineAttr_t *attr )
+{
+	stCoTaskGroup_t *group = (stCoTaskGroup_t*)calloc( 1,sizeof(stCoTaskGroup_t) );
+	group->attr = stCoRoutineAttr_t();
+	if( attr )
+	{
+		memcpy( &group->attr,attr,sizeof(group->attr) );
+	}
+	group->cond = co_cond_alloc();
+
+	stCoRoutine_t *owner = GetCurrThreadCo();
+	if( owner )
+	{
+		group->owner = owner;
+		group->pNextGroup = owner->pGroups;
+		owner->pGroups = group;
+		group->cCancel = owner->cCancel;
+	}
+	return group;
+}
+//groups outliving their owner must not unlink from it later
+static void DetachGroups( stCoRoutine_t *co )
+{
+	stCoTaskGroup_t *group = co->pGroups;
+	while( group )
+	{
+		stCoTaskGroup_t *next = group->pNextGroup;
+		group->owner = NULL;
+		group->pNextGroup = NULL;
+		group = next;
+	}
+	co->pGroups = NULL;
+}
+void co_group_free( stCoTaskGroup_t *group )
+{
+	if( !group )
+	{
+		return ;
+	}
+	if( group->owner )
+	{
+		stCoTaskGroup_t **pp = &group->owner->pGroups;
+		while( *pp && *pp != group )
+		{
+			pp = &(*pp)->pNextGroup;
+		}
+		if( *pp )
+		{
+			*pp = group->pNextGroup;
+		}
+	}
+	co_group_cancel( group );
+	for(int i=0;i<group->iTaskCnt;i++)
+	{
+		stCoTask_t *task = group->pTasks[i];
+		if( task->cDone )
+		{
+			co_release( task->co );
+			free( task );
+		}
+		else
+		{
+			task->group = NULL;
+		}
+	}
+	free( group->pTasks );
+	co_cond_free( group->cond );
+	free( group );
+}
+int co_group_spawn( stCoTaskGroup_t *group,pfn_co_routine_t pfn,void *arg )
+{
+	if( group->iTaskCnt == group->iTaskCap )
+	{
+		int cap = group->iTaskCap ? group->iTaskCap * 2 : 8;
+		stCoTask_t **tasks = (stCoTask_t**)realloc( group->pTasks,sizeof(stCoTask_t*) * cap );
+		if( !tasks )
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		group->pTasks = tasks;
+		group->iTaskCap = cap;
+	}
+	stCoTask_t *task = (stCoTask_t*)calloc( 1,sizeof(stCoTask_t) );
+	if( !task )
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	task->group = group;
+	task->pfn = pfn;
+	task->arg = arg;
+	task->release.pfnProcess = OnTaskReleaseEvent;
+	task->release.pArg = task;
+
+	if( co_create( &task->co,&group->attr,TaskRoutineFunc,task ) < 0 )
+	{
+		free( task );
+		return -1;
+	}
+	task->co->cCancel = group->cCancel;
+
+	int idx = group->iTaskCnt++;
+	group->pTasks[ idx ] = task;
+
+	co_resume( task->co );
+	return idx;
+}
+//a background routine nobody joins,the eventloop releases it after it returns
+stCoRoutine_t *co_spawn_detached( pfn_co_routine_t pfn,void *arg )
+{
+	stCoTask_t *task = (stCoTask_t*)calloc( 1,sizeof(stCoTask_t) );
+	if( !task )
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	task->pfn = pfn;
+	task->arg = arg;
+	task->release.pfnProcess = OnTaskReleaseEvent;
+	task->release.pArg = task;
+
+	if( co_create( &task->co,NULL,TaskRoutineFunc,task ) < 0 )
+	{
+		free( task );
+		return NULL;
+	}
+	stCoRoutine_t *co = task->co;
+	co_resume( co );
+	return co;
+}
+int co_group_wait( stCoTaskGroup_t *group,int count,int timeout_ms )
+{
+	if( count <= 0 || count > group->iTaskCnt )
+	{
+		count = group->iTaskCnt;
+	}
+	unsigned long long deadline = 0;
+	if( timeout_ms > 0 )
+	{
+		deadline = GetTickMS() + timeout_ms;
+	}
+	while( group->iDoneCnt < count )
+	{
+		int ms = -1;
+		if( deadline )
+		{
+			unsigned long long now = GetTickMS();
+			if( now >= deadline )
+			{
+				break;
+			}
+			ms = deadline - now;
+		}
+		else if( 0 == timeout_ms )
+		{
+			break;
+		}
+		if( CondTimedWait( group->cond,ms,CO_WAIT_JOIN ) < 0 )
+		{
+			break;
+		}
+	}
+	if( group->iDoneCnt < count )
+	{
+		errno = co_is_cancelled() ? ECANCELED : ETIMEDOUT;
+	}
+	return group->iDoneCnt;
+}
+int co_group_wait_all( stCoTaskGroup_t *group,int timeout_ms )
+{
+	return co_group_wait( group,0,timeout_ms );
+}
+int co_group_wait_any( stCoTaskGroup_t *group,int timeout_ms )
+{
+	return co_group_wait( group,1,timeout_ms );
+}
+int co_group_result( stCoTaskGroup_t *group,int idx,void **result )
+{
+	if( idx < 0 || idx >= group->iTaskCnt || !group->pTasks[ idx ]->cDone )
+	{
+		return -1;
+	}
+	if( result )
+	{
+		*result = group->pTasks[ idx ]->result;
+	}
+	return 0;
+}
+int co_group_cancel( stCoTaskGroup_t *group )
+{
+	group->cCancel = 1;
+	for(int i=0;i<group->iTaskCnt;i++)
+	{
+		if( !group->pTasks[i]->cDone )
+		{
+			co_cancel( group->pTasks[i]->co );
+		}
+	}
+	return 0;
+}
+
+//co cancel
+int co_cancel( stCoRoutine_t *co )
+{
+	if( !co || co->cIsMain || co->cEnd )
+	{
+		return -1;
+	}
+	co->cCancel = 1;
+
+	for( stCoTaskGroup_t *group = co->pGroups;group;group = group->pNextGroup )
+	{
+		co_group_cancel( group );
+	}
+
+	//wake it up from timeout/epoll/cond wait,the waiter sees cCancel
+	stTimeoutItem_t *item = co->pWaitItem;
+	if( item )
+	{
+		RemoveFromLink<stTimeoutItem_t,stTimeoutItemLink_t>( item );
+		item->bTimeout = false;
+		AddTail( co->env->pEpoll->pstActiveList,item );
+	}
+	return 0;
+}
+bool co_is_cancelled()
+{
+	stCoRoutine_t *co = GetCurrThreadCo();
+	return ( co && co->cCancel );
+}
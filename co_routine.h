@@ -54,6 +54,42 @@ void    co_reset(stCoRoutine_t * co);
 
 stCoRoutine_t *co_self();
 
+//blocked hooked calls of a cancelled routine return -1 with errno ECANCELED
+int 	co_cancel( stCoRoutine_t *co );
+bool 	co_is_cancelled();
+
+//stat of routines on current thread.
+//counters are only maintained when built with -D__LIBCO_STAT__
+enum
+{
+	CO_WAIT_NONE = 0,
+	CO_WAIT_FD,
+	CO_WAIT_TIMER,
+	CO_WAIT_COND,
+	CO_WAIT_JOIN,
+	CO_WAIT_BLOCKING, //co_run_blocking or io_uring
+};
+struct stCoRoutineStat_t
+{
+	unsigned long long ullId;
+	int iWaitReason; //CO_WAIT_*
+	int iWaitFd; //first fd for CO_WAIT_FD
+
+	unsigned long long ullResumeCnt;
+	unsigned long long ullRunCycles; //on cpu
+	unsigned long long ullBlockCycles; //parked with a wait reason
+};
+typedef void (*pfn_co_foreach_t)( stCoRoutine_t *co,void *arg );
+
+int 	co_get_stat( stCoRoutine_t *co,stCoRoutineStat_t *stat ); //-1 if counters are compiled out
+void 	co_foreach_ct( pfn_co_foreach_t pfn,void *arg ); //pfn must not free routines
+
+//deadline of current routine,inherited by routines it creates.
+//hooked blocking calls and co_cond_timedwait never wait past it,they fail with
+//ETIMEDOUT when it runs out.
+void 	co_set_deadline( int timeout_ms ); //timeout_ms < 0 clear
+int 	co_deadline_remaining(); //ms left,-1 if no deadline
+
 int		co_poll( stCoEpoll_t *ctx,struct pollfd fds[], nfds_t nfds, int timeout_ms );
 void 	co_eventloop( stCoEpoll_t *ctx,pfn_co_eventloop_t pfn,void *arg );
 
@@ -61,11 +97,37 @@ void 	co_eventloop( stCoEpoll_t *ctx,pfn_co_eventloop_t pfn,void *arg );
 
 int 	co_setspecific( pthread_key_t key, const void *value );
 void *	co_getspecific( pthread_key_t key );
+int 	co_setspecific_dtor( pthread_key_t key, const void *value,void (*destructor)(void*) );
 
 //4.event
 
 stCoEpoll_t * 	co_get_epoll_ct(); //ct = current thread
 
+//eventloop health,written by the loop thread only and
+//readable lock-free from any thread by co_read_epoll_stat
+struct stCoHistogram_t
+{
+	enum
+	{
+		eBucketCnt = 32
+	};
+	unsigned long long ullCnt;
+	unsigned long long ullSum;
+	unsigned long long ullMax;
+	unsigned long long aBucket[ eBucketCnt ]; //[0]: 0,[i]: [ 2^(i-1),2^i )
+};
+struct stCoEpollStat_t
+{
+	unsigned long long ullLoopCnt;
+
+	stCoHistogram_t stEvents; //events per co_epoll_wait
+	stCoHistogram_t stTimeouts; //timeouts fired per loop
+	stCoHistogram_t stActive; //active items processed per loop
+	stCoHistogram_t stRunUs; //us running routines per loop
+	stCoHistogram_t stLatenessMs; //ms from ullExpireTime to the timeout running
+};
+void 	co_read_epoll_stat( stCoEpoll_t *ctx,stCoEpollStat_t *stat );
+
 //5.hook syscall ( poll/read/write/recv/send/recvfrom/sendto )
 
 void 	co_enable_hook_sys();  
@@ -107,5 +169,200 @@ struct rpchook_t
 
 rpchook_t* alloc_by_fd(int fd);
 
+//10.task group
+//spawn child coroutines on the current loop and wait for all,any or a quorum of them.
+//children still running when the group is freed are detached and released by the eventloop.
+struct stCoTaskGroup_t;
+
+stCoTaskGroup_t *co_group_alloc( const stCoRoutineAttr_t *attr ); //attr->share_stack is used by all children
+void	co_group_free( stCoTaskGroup_t *group );
+
+int 	co_group_spawn( stCoTaskGroup_t *group,pfn_co_routine_t pfn,void *arg ); //return task idx
+int 	co_group_wait( stCoTaskGroup_t *group,int count,int timeout_ms ); //return done cnt,errno ETIMEDOUT if < count
+int 	co_group_wait_all( stCoTaskGroup_t *group,int timeout_ms );
+int 	co_group_wait_any( stCoTaskGroup_t *group,int timeout_ms );
+int 	co_group_result( stCoTaskGroup_t *group,int idx,void **result ); //0 if task idx is done
+int 	co_group_cancel( stCoTaskGroup_t *group ); //co_cancel all outstanding children
+
+//11.watchdog
+//a monitor thread reports routines running longer than threshold_ms without
+//switching to report_fd,with a backtrace taken by signal signo ( 0 for none )
+int 	co_watchdog_start( int threshold_ms,int report_fd,int signo );
+void 	co_watchdog_stop();
+
+//12.dump
+//write every live routine of the current thread with its state,wait reason and
+//a symbolized backtrace to fd.suspended routines are unwound by frame pointer.
+int 	co_dump_all( int fd ); //return routine cnt
+int 	co_dump_on_signal( int signo,int fd ); //dump the thread the signal lands on
+
+//13.profile
+//SIGPROF sampling,attributed to the running routine and its tag.
+//co_profile_dump writes folded stacks ( tag;[routine id];root;...;leaf count ) for flame graphs.
+enum
+{
+	CO_PROFILE_BY_ROUTINE = 1, //split stacks by routine id
+};
+void	co_set_tag( const char *tag ); //tag must outlive the profile,eg. a literal
+int 	co_profile_start( int hz,int flags );
+void	co_profile_stop();
+int 	co_profile_dump( int fd ); //return stack cnt
+void	co_profile_reset(); //after co_profile_stop
+void	co_profile_counts( unsigned long long *samples,unsigned long long *dropped );
+
+//14.trace
+//record switches,epoll wakes,timer fires and hooked syscalls into a bounded ring per thread.
+//co_trace_export writes chrome trace-event json ( chrome://tracing,perfetto ),one track per routine.
+int 	co_trace_start( int events_per_thread ); //starts a new recording
+void	co_trace_stop();
+int 	co_trace_export( int fd ); //return thread cnt,call after co_trace_stop for a consistent view
+
+//15.udp batch
+//move many datagrams per wakeup with recvmmsg/sendmmsg,and coalesce with UDP_GRO/UDP_SEGMENT
+//where the kernel offers them.
+struct stCoDatagram_t
+{
+	void *buf;
+	size_t len; //recv: buf size in,datagram size out
+	struct sockaddr_storage addr; //send: not used if addrlen is 0
+	socklen_t addrlen;
+	int segsize; //recv: GRO coalesced segments of segsize bytes,0 for a plain datagram
+};
+int 	co_udp_recv_batch( int fd,stCoDatagram_t *dgrams,int cnt,int timeout_ms ); //return cnt,0 on timeout
+int 	co_udp_send_batch( int fd,const stCoDatagram_t *dgrams,int cnt,int timeout_ms ); //return sent cnt
+int 	co_udp_enable_gro( int fd );
+int 	co_udp_send_gso( int fd,const void *buf,size_t len,int segsize,
+			const struct sockaddr *addr,socklen_t addrlen ); //return bytes,segments by hand where the socket has no gso
+
+//16.zero copy send
+//MSG_ZEROCOPY sends that pin buf instead of copying it.the eventloop reads completions
+//from the socket error queue;buf must stay untouched until the send returns ( sync )
+//or done is called ( async,called exactly once ).sends below CO_ZEROCOPY_MIN_SIZE,
+//and all sends on a socket the kernel reports as copied ( eg. loopback ),fall back to send().
+enum
+{
+	CO_ZEROCOPY_MIN_SIZE = 16 * 1024,
+};
+typedef void (*pfn_co_zerocopy_done_t)( const void *buf,size_t len,void *arg );
+
+int 	co_zerocopy_enable( int fd ); //SO_ZEROCOPY,-1 if the kernel lacks it
+//waits for POLLOUT as long as the hooked write does.when canceled or past the deadline
+//it returns the bytes already queued,buf stays pinned until co_zerocopy_release
+ssize_t co_zerocopy_send( int fd,const void *buf,size_t len,int flags );
+ssize_t co_zerocopy_send_async( int fd,const void *buf,size_t len,int flags,
+			pfn_co_zerocopy_done_t done,void *arg );
+int 	co_zerocopy_release( int fd,int timeout_ms ); //wait for outstanding sends,call before close
+
+//17.file to socket
+//stream [offset,offset + count) of file_fd with sendfile,or splice through a pipe where
+//sendfile is refused.parks on POLLOUT,return bytes sent ( short at eof ) or -1
+ssize_t co_sendfile_range( int sock,int file_fd,off_t offset,size_t count,int timeout_ms );
+
+//18.blocking offload
+//run pfn( arg ) on a helper thread pool,the calling routine parks and is resumed
+//by its own co_eventloop,errno is carried back. outside a routine pfn runs inline.
+//from a shared stack routine,arg must not point into its stack.
+typedef void *(*pfn_co_blocking_t)( void *arg );
+
+void *	co_run_blocking( pfn_co_blocking_t pfn,void *arg );
+int 	co_blocking_set_threads( int cnt ); //pool size,default 4
+
+//route hooked open/pread/pwrite/fsync/stat of non-socket fds through co_run_blocking
+void 	co_enable_blocking_hook( bool on );
+bool 	co_is_blocking_hook();
+
+//19.file io
+//pread/pwrite/fsync that park the routine: io_uring of the loop when the kernel
+//has it,sqes of one lap go in a single io_uring_enter,else co_run_blocking
+ssize_t co_pread( int fd,void *buf,size_t count,off_t offset );
+ssize_t co_pwrite( int fd,const void *buf,size_t count,off_t offset );
+int 	co_fsync( int fd );
+
+//20.dns
+//resolver for hooked gethostbyname/getaddrinfo: /etc/hosts,then udp queries
+//to the resolv.conf nameservers. answers are cached per ttl for the process,
+//lookups of one name in a loop share a query.
+//co_resolve returns addresses found ( port 0 ),or -1 with errno:
+//ENOENT no such name,ENODATA no address of family,ETIMEDOUT,ECANCELED
+struct addrinfo;
+int 	co_resolve( const char *name,int family,struct sockaddr_storage *addrs,int cnt );
+int 	co_getaddrinfo( const char *node,const char *service,const struct addrinfo *hints,struct addrinfo **res );
+int 	co_resolver_set_nameserver( const char *ip,int port ); //replaces resolv.conf servers,clears the cache
+void 	co_resolver_flush();
+
+//21.stream
+//buffered io over an fd through the hooked read/write,so waits follow its
+//SO_RCVTIMEO/SO_SNDTIMEO and the routine deadline.
+//pending writes are flushed when full and before a read has to wait.
+struct stCoStream_t;
+
+stCoStream_t *	co_stream_alloc( int fd,int rbuf_size,int wbuf_size ); //0 for 16k
+void 	co_stream_free( stCoStream_t *s ); //neither flushes nor closes fd
+int 	co_stream_fd( stCoStream_t *s );
+int 	co_stream_buffered( stCoStream_t *s ); //bytes read ahead
+
+ssize_t co_stream_read( stCoStream_t *s,void *buf,size_t len ); //like read
+ssize_t co_stream_readn( stCoStream_t *s,void *buf,size_t n ); //n,short only at eof
+//up to and including delim,or size bytes if it is not found within them,
+//or what is left at eof. 0 at eof
+ssize_t co_stream_read_until( stCoStream_t *s,const void *delim,size_t dlen,void *buf,size_t size );
+ssize_t co_stream_readline( stCoStream_t *s,void *buf,size_t size );
+
+//what fits in wbuf is taken even when flushing it fails,that error comes from
+//the next write or flush. short only when a large write could not get out
+ssize_t co_stream_write( stCoStream_t *s,const void *buf,size_t len );
+int 	co_stream_flush( stCoStream_t *s );
+
+//22.connection pool
+//client connections of one loop,keyed by destination.co_pool_borrow hands out an
+//idle connection,connects a new one,or waits while the destination is at max.
+//a background routine closes connections idle past idle_timeout_ms,drops the ones
+//the peer closed or check rejects,and reconnects up to min_idle_per_dest.
+//pool sockets go through the hooks: borrowers should co_enable_hook_sys.
+typedef int (*pfn_co_pool_check_t)( int fd,void *arg ); //0 if the idle connection is good
+struct stCoPoolAttr_t
+{
+	int max_per_dest;
+	int min_idle_per_dest;
+	int idle_timeout_ms;
+	int connect_timeout_ms;
+	int check_interval_ms; //background lap
+	pfn_co_pool_check_t check; //active probe per idle connection and lap,may park
+	void *check_arg;
+	stCoPoolAttr_t()
+	{
+		max_per_dest = 16;
+		min_idle_per_dest = 0;
+		idle_timeout_ms = 60 * 1000;
+		connect_timeout_ms = 1000;
+		check_interval_ms = 1000;
+		check = NULL;
+		check_arg = NULL;
+	}
+};
+struct stCoPoolStat_t
+{
+	int iDests;
+	int iIdle;
+	int iBusy; //borrowed
+	int iWaiters;
+
+	unsigned long long ullConnects;
+	unsigned long long ullConnectFails;
+	unsigned long long ullReuses;
+	unsigned long long ullEvicted; //idle timeout
+	unsigned long long ullBroken; //peer closed,check failed or returned broken
+};
+struct stCoPool_t;
+
+stCoPool_t *	co_pool_alloc( const stCoPoolAttr_t *attr ); //on the loop of the current thread,NULL with errno
+//return everything first,idle connections are closed.routines parked in co_pool_borrow
+//fail with ECANCELED
+void 	co_pool_free( stCoPool_t *pool );
+//fd or -1 with errno: ETIMEDOUT,ECANCELED or from connect.timeout_ms <= 0 waits for a slot forever
+int 	co_pool_borrow( stCoPool_t *pool,const struct sockaddr *addr,socklen_t addrlen,int timeout_ms );
+int 	co_pool_return( stCoPool_t *pool,int fd,bool reuse ); //reuse false closes it,eg. after an io error
+void 	co_pool_get_stat( stCoPool_t *pool,stCoPoolStat_t *stat );
+
 #endif
 
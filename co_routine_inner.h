@@ -22,9 +22,26 @@
 #include "co_routine.h"
 #include "coctx.h"
 struct stCoRoutineEnv_t;
+struct stTimeoutItem_t;
+struct stCoEpoll_t;
 struct stCoSpec_t
 {
+	pthread_key_t key;
 	void *value;
+	void (*pfnDestructor)( void * ); //run when the routine ends or is reset
+};
+struct stCoSpecTable_t
+{
+	enum
+	{
+		eInlineSize = 4
+	};
+	stCoSpec_t aInline[ eInlineSize ]; //first keys set by the routine
+	int iInlineCnt;
+
+	stCoSpec_t *pExtra; //the rest,sorted by key
+	int iExtraCnt;
+	int iExtraCap;
 };
 
 struct stStackMem_t
@@ -46,6 +63,12 @@ struct stShareStack_t
 
 
 
+struct stCoRoutineLink_t
+{
+	stCoRoutine_t *head;
+	stCoRoutine_t *tail;
+};
+
 struct stCoRoutine_t
 {
 	stCoRoutineEnv_t *env;
@@ -53,14 +76,38 @@ struct stCoRoutine_t
 	void *arg;
 	coctx_t ctx;
 
+	//all live routines of env
+	stCoRoutine_t *pPrev;
+	stCoRoutine_t *pNext;
+	stCoRoutineLink_t *pLink;
+	unsigned long long ullId;
+
 	char cStart;
 	char cEnd;
 	char cIsMain;
 	char cEnableSysHook;
 	char cIsShareStack;
+	char cCancel;
 
 	void *pvEnv;
 
+	unsigned long long ullDeadline; //GetTickMS(),0 means none
+
+	stTimeoutItem_t *pWaitItem; //where we are parked,for co_cancel
+	stCoTaskGroup_t *pGroups; //groups spawned by us
+
+	char cWaitReason; //CO_WAIT_*
+	int iWaitFd;
+
+	const char *pszTag; //co_set_tag,for the profiler
+
+#if defined( __LIBCO_STAT__ )
+	unsigned long long ullResumeCnt;
+	unsigned long long ullRunCycles;
+	unsigned long long ullBlockCycles;
+	unsigned long long ullSwitchCycles; //last switch in or out
+#endif
+
 	//char sRunStack[ 1024 * 128 ];
 	stStackMem_t* stack_mem;
 
@@ -70,12 +117,27 @@ struct stCoRoutine_t
 	unsigned int save_size;
 	char* save_buffer;
 
-	stCoSpec_t aSpec[1024];
+	stCoSpecTable_t stSpec;
 
 };
 
 
 
+struct stCoRoutineEnv_t
+{
+	stCoRoutine_t *pCallStack[ 128 ];
+	int iCallStackSize;
+	stCoEpoll_t *pEpoll;
+
+	//for copy stack log lastco and nextco
+	stCoRoutine_t* pending_co;
+	stCoRoutine_t* occupy_co;
+
+	stCoRoutineLink_t stLiveList;
+
+	unsigned long long ullHeartbeat; //bumped by co_swap and each loop,for watchdog
+};
+
 //1.env
 void 				co_init_curr_thread_env();
 stCoRoutineEnv_t *	co_get_curr_thread_env();
@@ -97,13 +159,53 @@ stTimeout_t *AllocTimeout( int iSize );
 void 	FreeTimeout( stTimeout_t *apTimeout );
 int  	AddTimeout( stTimeout_t *apTimeout,stTimeoutItem_t *apItem ,uint64_t allNow );
 
-struct stCoEpoll_t;
 stCoEpoll_t * AllocEpoll();
 void 		FreeEpoll( stCoEpoll_t *ctx );
 
 stCoRoutine_t *		GetCurrThreadCo();
 void 				SetEpoll( stCoRoutineEnv_t *env,stCoEpoll_t *ev );
 
+//watchdog: envs running co_eventloop
+void 	co_watchdog_add_env( stCoRoutineEnv_t *env );
+void 	co_watchdog_del_env( stCoRoutineEnv_t *env );
+
+//trace: timeline recorder,see co_trace_start
+enum
+{
+	CO_TRACE_SWITCH = 1, //arg1 to id
+	CO_TRACE_WAKE, //arg1 events
+	CO_TRACE_TIMER, //arg1 late ms
+	CO_TRACE_SYS_ENTER, //arg1 fd
+	CO_TRACE_SYS_EXIT, //arg1 fd,arg2 ret
+};
+extern int g_co_trace_on;
+void 	co_trace_add( int type,unsigned long long id,const char *name,long arg1,long arg2 ); //id 0 for self
+
+#define CO_TRACE( type,id,name,arg1,arg2 ) \
+	do { if( __builtin_expect( g_co_trace_on,0 ) ) co_trace_add( type,id,name,arg1,arg2 ); } while(0)
+
+//hook: the fd's SO_SNDTIMEO in ms as the hooked write waits,-1 if it is not hooked
+int 	co_hook_write_timeout( int fd );
+
+//zero copy: drain socket error queues,every eventloop lap
+void 	co_zerocopy_reap();
+
+//io_uring: submit queued sqes,before each epoll wait
+void 	co_uring_flush();
+
+//wakeup: pfn( arg ) runs on the loop owning ctx after co_wakeup_signal from any thread
+struct stCoWakeup_t;
+typedef void (*pfn_co_wakeup_t)( void *arg );
+
+stCoWakeup_t *	co_wakeup_alloc( stCoEpoll_t *ctx,pfn_co_wakeup_t pfn,void *arg );
+int 	co_wakeup_fd( stCoWakeup_t *w ); //eventfd,may be handed to the kernel
+void 	co_wakeup_signal( stCoWakeup_t *w );
+void 	co_wakeup_free( stCoWakeup_t *w );
+
+//spawn a routine that releases itself when it returns,the pointer is only
+//good while it runs. NULL with errno on failure
+stCoRoutine_t *	co_spawn_detached( pfn_co_routine_t pfn,void *arg );
+
 typedef void (*pfnCoRoutineFunc_t)();
 
 #endif
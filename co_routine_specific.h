@@ -19,6 +19,7 @@
 #pragma once
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
 /*
 invoke only once in the whole program
@@ -43,15 +44,88 @@ int main()
 */
 extern int 	co_setspecific( pthread_key_t key, const void *value );
 extern void *	co_getspecific( pthread_key_t key );
+extern int 	co_setspecific_dtor( pthread_key_t key, const void *value,void (*destructor)(void*) );
+
+/*
+data of CO_ROUTINE_SPECIFIC is recycled into a per-thread free list when
+the routine ends or is reset,and comes back zeroed like calloc.
+a type holding other resources can release them by declaring,
+before CO_ROUTINE_SPECIFIC:
+
+static void co_routine_specific_cleanup( MyData_t *p ) { free( p->buffer ); }
+*/
+template <class T>
+inline void co_routine_specific_cleanup( T * )
+{
+}
+
+template <class T>
+class clsRoutineSpecificPool
+{
+public:
+	enum
+	{
+		eMaxFreeCnt = 128
+	};
+	static T *Get()
+	{
+		stFree_t *&head = Head();
+		if( head )
+		{
+			stFree_t *p = head;
+			head = p->next;
+			Count()--;
+			memset( p,0,Size() );
+			return (T*)p;
+		}
+		return (T*)calloc( 1,Size() );
+	}
+	static void Put( void *p )
+	{
+		if( Count() >= eMaxFreeCnt )
+		{
+			free( p );
+			return ;
+		}
+		stFree_t *lp = (stFree_t*)p;
+		lp->next = Head();
+		Head() = lp;
+		Count()++;
+	}
+private:
+	struct stFree_t
+	{
+		stFree_t *next;
+	};
+	static size_t Size()
+	{
+		return sizeof(T) > sizeof(stFree_t) ? sizeof(T) : sizeof(stFree_t);
+	}
+	static stFree_t *&Head()
+	{
+		static __thread stFree_t *head = NULL;
+		return head;
+	}
+	static int &Count()
+	{
+		static __thread int cnt = 0;
+		return cnt;
+	}
+};
 
 #define CO_ROUTINE_SPECIFIC( name,y ) \
 \
 static pthread_once_t _routine_once_##name = PTHREAD_ONCE_INIT; \
 static pthread_key_t _routine_key_##name;\
 static int _routine_init_##name = 0;\
+static void _routine_free_##name( void *p ) \
+{\
+	co_routine_specific_cleanup( (name*)p );\
+	clsRoutineSpecificPool<name>::Put( p );\
+}\
 static void _routine_make_key_##name() \
 {\
- 	(void) pthread_key_create(&_routine_key_##name, NULL); \
+ 	(void) pthread_key_create(&_routine_key_##name, _routine_free_##name); \
 }\
 template <class T>\
 class clsRoutineData_routine_##name\
@@ -67,13 +141,13 @@ public:\
 		T* p = (T*)co_getspecific( _routine_key_##name );\
 		if( !p )\
 		{\
-			p = (T*)calloc(1,sizeof( T ));\
-			int ret = co_setspecific( _routine_key_##name,p) ;\
+			p = clsRoutineSpecificPool<T>::Get();\
+			int ret = co_setspecific_dtor( _routine_key_##name,p,_routine_free_##name ) ;\
             if ( ret )\
             {\
                 if ( p )\
                 {\
-                    free(p);\
+                    _routine_free_##name(p);\
                     p = NULL;\
                 }\
             }\
@@ -83,4 +157,3 @@ public:\
 };\
 \
 static clsRoutineData_routine_##name<name> y;
-
@@ -0,0 +1,323 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+//all io goes through the hooked read/write/writev,so waits get the fd's
+//SO_RCVTIMEO/SO_SNDTIMEO and the routine deadline for free.
+//the read side is a sliding window: [head,tail) unread,compacted when the
+//tail hits the end.
+enum
+{
+	eStreamDefaultSize = 16 * 1024,
+};
+struct stCoStream_t
+{
+	int fd;
+
+	char *rbuf;
+	int rcap;
+	int rhead;
+	int rtail;
+	bool bEof;
+
+	char *wbuf;
+	int wcap;
+	int wlen;
+};
+
+stCoStream_t *co_stream_alloc( int fd,int rbuf_size,int wbuf_size )
+{
+	stCoStream_t *s = (stCoStream_t*)calloc( 1,sizeof(stCoStream_t) );
+	s->fd = fd;
+	s->rcap = rbuf_size > 0 ? rbuf_size : eStreamDefaultSize;
+	s->wcap = wbuf_size > 0 ? wbuf_size : eStreamDefaultSize;
+	s->rbuf = (char*)malloc( s->rcap );
+	s->wbuf = (char*)malloc( s->wcap );
+	return s;
+}
+void co_stream_free( stCoStream_t *s )
+{
+	if( !s )
+	{
+		return ;
+	}
+	free( s->rbuf );
+	free( s->wbuf );
+	free( s );
+}
+int co_stream_fd( stCoStream_t *s )
+{
+	return s->fd;
+}
+int co_stream_buffered( stCoStream_t *s )
+{
+	return s->rtail - s->rhead;
+}
+
+//keep whatever was not written at the front of wbuf
+static int KeepUnwritten( stCoStream_t *s,ssize_t written )
+{
+	int err = errno;
+	if( written > 0 )
+	{
+		memmove( s->wbuf,s->wbuf + written,s->wlen - written );
+		s->wlen -= written;
+	}
+	errno = err;
+	return -1;
+}
+
+int co_stream_flush( stCoStream_t *s )
+{
+	if( !s->wlen )
+	{
+		return 0;
+	}
+	//the hooked write keeps going until everything is out or it times out
+	ssize_t ret = write( s->fd,s->wbuf,s->wlen );
+	if( ret != s->wlen )
+	{
+		return KeepUnwritten( s,ret );
+	}
+	s->wlen = 0;
+	return 0;
+}
+
+//one more read into the window: > 0 bytes added,0 eof or no room,-1 error
+static int Fill( stCoStream_t *s )
+{
+	if( s->bEof )
+	{
+		return 0;
+	}
+	if( s->rhead == s->rtail )
+	{
+		s->rhead = s->rtail = 0;
+	}
+	else if( s->rtail == s->rcap && s->rhead > 0 )
+	{
+		memmove( s->rbuf,s->rbuf + s->rhead,s->rtail - s->rhead );
+		s->rtail -= s->rhead;
+		s->rhead = 0;
+	}
+	if( s->rtail == s->rcap )
+	{
+		return 0;
+	}
+	//a request is fully written before we wait for its answer
+	if( s->wlen && co_stream_flush( s ) < 0 )
+	{
+		return -1;
+	}
+	ssize_t ret = read( s->fd,s->rbuf + s->rtail,s->rcap - s->rtail );
+	if( ret > 0 )
+	{
+		s->rtail += ret;
+		return ret;
+	}
+	if( ret == 0 )
+	{
+		s->bEof = true;
+	}
+	return ret;
+}
+
+static int Take( stCoStream_t *s,void *buf,int len )
+{
+	memcpy( buf,s->rbuf + s->rhead,len );
+	s->rhead += len;
+	return len;
+}
+
+ssize_t co_stream_read( stCoStream_t *s,void *buf,size_t len )
+{
+	if( !len )
+	{
+		return 0;
+	}
+	if( s->rhead == s->rtail )
+	{
+		//no point copying twice
+		if( len >= (size_t)s->rcap && !s->wlen )
+		{
+			if( s->bEof )
+			{
+				return 0;
+			}
+			ssize_t ret = read( s->fd,buf,len );
+			s->bEof = ret == 0;
+			return ret;
+		}
+		int ret = Fill( s );
+		if( ret <= 0 )
+		{
+			return ret;
+		}
+	}
+	int avail = s->rtail - s->rhead;
+	return Take( s,buf,len < (size_t)avail ? (int)len : avail );
+}
+
+ssize_t co_stream_readn( stCoStream_t *s,void *buf,size_t n )
+{
+	//nothing is consumed until all of n is in the window
+	while( n <= (size_t)s->rcap && (size_t)( s->rtail - s->rhead ) < n )
+	{
+		int ret = Fill( s );
+		if( ret < 0 )
+		{
+			return -1;
+		}
+		if( ret == 0 )
+		{
+			if( !s->bEof )
+			{
+				break; //no room: the window has to slide,below
+			}
+			return Take( s,buf,s->rtail - s->rhead ); //short at eof
+		}
+	}
+	if( (size_t)( s->rtail - s->rhead ) >= n )
+	{
+		return Take( s,buf,n );
+	}
+	//larger than the window: what was read is lost on failure
+	size_t done = 0;
+	while( done < n )
+	{
+		ssize_t ret = co_stream_read( s,(char*)buf + done,n - done );
+		if( ret < 0 )
+		{
+			return -1;
+		}
+		if( ret == 0 )
+		{
+			break;
+		}
+		done += ret;
+	}
+	return done;
+}
+
+ssize_t co_stream_read_until( stCoStream_t *s,const void *delim,size_t dlen,void *buf,size_t size )
+{
+	if( !dlen || !size )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	const char *d = (const char*)delim;
+	size_t scanned = 0;
+	for(;;)
+	{
+		size_t avail = s->rtail - s->rhead;
+		const char *base = s->rbuf + s->rhead;
+		//memchr for the first byte is the vectorized part
+		while( scanned + dlen <= avail )
+		{
+			const char *p = (const char*)memchr( base + scanned,d[0],avail - scanned - dlen + 1 );
+			if( !p )
+			{
+				scanned = avail - dlen + 1;
+				break;
+			}
+			if( memcmp( p,d,dlen ) == 0 )
+			{
+				size_t len = p - base + dlen;
+				return Take( s,buf,len < size ? len : size );
+			}
+			scanned = p - base + 1;
+		}
+		if( avail >= size )
+		{
+			return Take( s,buf,size ); //no delimiter within size,like fgets
+		}
+		int ret = Fill( s );
+		if( ret < 0 )
+		{
+			return -1;
+		}
+		if( ret == 0 )
+		{
+			//eof,or a full window without the delimiter
+			return Take( s,buf,avail < size ? avail : size );
+		}
+	}
+}
+
+ssize_t co_stream_readline( stCoStream_t *s,void *buf,size_t size )
+{
+	return co_stream_read_until( s,"\n",1,buf,size );
+}
+
+ssize_t co_stream_write( stCoStream_t *s,const void *buf,size_t len )
+{
+	if( s->wlen + len <= (size_t)s->wcap )
+	{
+		memcpy( s->wbuf + s->wlen,buf,len );
+		s->wlen += len;
+		if( s->wlen == s->wcap )
+		{
+			co_stream_flush( s ); //buf is taken either way,the next write or flush reports the error
+		}
+		return len;
+	}
+	//too big to buffer: what is pending and buf leave in one writev
+	struct iovec iov[2];
+	iov[0].iov_base = s->wbuf;
+	iov[0].iov_len = s->wlen;
+	iov[1].iov_base = (void*)buf;
+	iov[1].iov_len = len;
+	ssize_t total = s->wlen + len;
+	ssize_t ret = writev( s->fd,iov + ( s->wlen ? 0 : 1 ),s->wlen ? 2 : 1 );
+	if( ret == total )
+	{
+		s->wlen = 0;
+		return len;
+	}
+	if( ret < 0 )
+	{
+		return KeepUnwritten( s,ret );
+	}
+	if( ret <= s->wlen )
+	{
+		//only pending went out: take what of buf fits behind the rest of it,
+		//a short write now and the error from the next write or flush
+		KeepUnwritten( s,ret );
+		size_t n = (size_t)( s->wcap - s->wlen ) < len ? (size_t)( s->wcap - s->wlen ) : len;
+		if( !n )
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+		memcpy( s->wbuf + s->wlen,buf,n );
+		s->wlen += n;
+		return n;
+	}
+	//pending is out,part of buf is not: report what of buf was written
+	ssize_t written = ret - s->wlen;
+	s->wlen = 0;
+	return written;
+}
@@ -0,0 +1,477 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_tls.h"
+#include "co_routine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <map>
+
+#include <openssl/err.h>
+#include <openssl/bio.h>
+
+//the bio does no waiting of its own: the hooked read/write park the routine,
+//and only when they give up with EAGAIN does the bio ask ssl for a retry.
+enum
+{
+	eTlsBufSize = 32 * 1024, //a full record and then some
+	eTlsMaxSessions = 1024,
+};
+struct stCoTls_t
+{
+	SSL *ssl;
+	int fd;
+	bool bServer;
+	int iErrno; //of the last failed read/write under ssl
+	std::string sHost;
+
+	char *rbuf;
+	int rhead;
+	int rtail;
+
+	char *wbuf;
+	int wlen;
+};
+
+typedef std::map<std::string,SSL_SESSION*> CoTlsSessions_t;
+static __thread CoTlsSessions_t *t_tls_sessions = NULL;
+
+static BIO_METHOD *g_tls_bio_method = NULL;
+static pthread_once_t g_tls_bio_once = PTHREAD_ONCE_INIT;
+
+//pending records out through the hooked write,what is not written stays
+static int FlushTls( stCoTls_t *t )
+{
+	if( !t->wlen )
+	{
+		return 0;
+	}
+	ssize_t ret = write( t->fd,t->wbuf,t->wlen );
+	if( ret == t->wlen )
+	{
+		t->wlen = 0;
+		return 0;
+	}
+	int err = errno;
+	if( ret > 0 )
+	{
+		memmove( t->wbuf,t->wbuf + ret,t->wlen - ret );
+		t->wlen -= ret;
+		err = EAGAIN;
+	}
+	t->iErrno = err;
+	errno = err;
+	return -1;
+}
+
+static int TlsBioFailed( BIO *b,stCoTls_t *t,bool reading )
+{
+	//a timeout leaves ssl in a state it can go on from
+	if( t->iErrno == EAGAIN )
+	{
+		if( reading )
+		{
+			BIO_set_retry_read( b );
+		}
+		else
+		{
+			BIO_set_retry_write( b );
+		}
+	}
+	return -1;
+}
+
+static int TlsBioRead( BIO *b,char *buf,int len )
+{
+	stCoTls_t *t = (stCoTls_t*)BIO_get_data( b );
+	BIO_clear_retry_flags( b );
+	if( len <= 0 )
+	{
+		return 0;
+	}
+	if( t->rhead == t->rtail )
+	{
+		//whatever we owe the peer goes before we wait for it
+		if( FlushTls( t ) < 0 )
+		{
+			return TlsBioFailed( b,t,true );
+		}
+		t->rhead = t->rtail = 0;
+		ssize_t ret = read( t->fd,t->rbuf,eTlsBufSize );
+		if( ret <= 0 )
+		{
+			t->iErrno = ret < 0 ? errno : 0;
+			return ret < 0 ? TlsBioFailed( b,t,true ) : 0;
+		}
+		t->rtail = ret;
+	}
+	int n = t->rtail - t->rhead;
+	if( n > len )
+	{
+		n = len;
+	}
+	memcpy( buf,t->rbuf + t->rhead,n );
+	t->rhead += n;
+	return n;
+}
+
+static int TlsBioWrite( BIO *b,const char *buf,int len )
+{
+	stCoTls_t *t = (stCoTls_t*)BIO_get_data( b );
+	BIO_clear_retry_flags( b );
+	if( len <= 0 )
+	{
+		return 0;
+	}
+	if( t->wlen + len > eTlsBufSize && FlushTls( t ) < 0 )
+	{
+		return TlsBioFailed( b,t,false );
+	}
+	if( len > eTlsBufSize )
+	{
+		//ssl takes a short write and comes back for the rest
+		ssize_t ret = write( t->fd,buf,len );
+		if( ret > 0 )
+		{
+			return ret;
+		}
+		t->iErrno = errno;
+		return TlsBioFailed( b,t,false );
+	}
+	memcpy( t->wbuf + t->wlen,buf,len );
+	t->wlen += len;
+	return len;
+}
+
+static long TlsBioCtrl( BIO *b,int cmd,long num,void *ptr )
+{
+	stCoTls_t *t = (stCoTls_t*)BIO_get_data( b );
+	switch( cmd )
+	{
+		case BIO_CTRL_FLUSH:
+			BIO_clear_retry_flags( b );
+			if( FlushTls( t ) < 0 )
+			{
+				TlsBioFailed( b,t,false );
+				return 0;
+			}
+			return 1;
+		case BIO_CTRL_PENDING:
+			return t->rtail - t->rhead;
+		case BIO_CTRL_WPENDING:
+			return t->wlen;
+		case BIO_CTRL_DUP:
+			return 1;
+	}
+	return 0;
+}
+
+static void InitTlsBioMethod()
+{
+	BIO_METHOD *m = BIO_meth_new( BIO_get_new_index() | BIO_TYPE_SOURCE_SINK,"libco" );
+	if( m )
+	{
+		BIO_meth_set_read( m,TlsBioRead );
+		BIO_meth_set_write( m,TlsBioWrite );
+		BIO_meth_set_ctrl( m,TlsBioCtrl );
+	}
+	g_tls_bio_method = m;
+}
+
+//loop session cache,client side
+static std::string SessionKey( stCoTls_t *t )
+{
+	char buf[128] = { 0 };
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+	memset( &ss,0,sizeof(ss) );
+	getpeername( t->fd,(struct sockaddr*)&ss,&len );
+	char ip[INET6_ADDRSTRLEN] = { 0 };
+	int port = 0;
+	if( ss.ss_family == AF_INET )
+	{
+		struct sockaddr_in *in = (struct sockaddr_in*)&ss;
+		inet_ntop( AF_INET,&in->sin_addr,ip,sizeof(ip) );
+		port = ntohs( in->sin_port );
+	}
+	else if( ss.ss_family == AF_INET6 )
+	{
+		struct sockaddr_in6 *in6 = (struct sockaddr_in6*)&ss;
+		inet_ntop( AF_INET6,&in6->sin6_addr,ip,sizeof(ip) );
+		port = ntohs( in6->sin6_port );
+	}
+	snprintf( buf,sizeof(buf),"%p|%s|%d|",SSL_get_SSL_CTX( t->ssl ),ip,port );
+	return buf + t->sHost;
+}
+
+static bool SessionAlive( SSL_SESSION *sess )
+{
+	return SSL_SESSION_is_resumable( sess )
+		&& SSL_SESSION_get_time( sess ) + SSL_SESSION_get_timeout( sess ) > time( NULL );
+}
+
+static int OnNewSession( SSL *ssl,SSL_SESSION *sess )
+{
+	stCoTls_t *t = (stCoTls_t*)SSL_get_app_data( ssl );
+	if( !t || t->bServer )
+	{
+		return 0;
+	}
+	if( !t_tls_sessions )
+	{
+		t_tls_sessions = new CoTlsSessions_t();
+	}
+	std::string key = SessionKey( t );
+	CoTlsSessions_t::iterator it = t_tls_sessions->find( key );
+	if( it != t_tls_sessions->end() )
+	{
+		SSL_SESSION_free( it->second );
+		it->second = sess;
+		return 1;
+	}
+	if( t_tls_sessions->size() >= (size_t)eTlsMaxSessions )
+	{
+		//no lru,an arbitrary victim is good enough to bound it
+		SSL_SESSION_free( t_tls_sessions->begin()->second );
+		t_tls_sessions->erase( t_tls_sessions->begin() );
+	}
+	t_tls_sessions->insert( std::make_pair( key,sess ) );
+	return 1; //the reference is ours now
+}
+
+static void ResumeSession( stCoTls_t *t )
+{
+	if( !t_tls_sessions )
+	{
+		return ;
+	}
+	CoTlsSessions_t::iterator it = t_tls_sessions->find( SessionKey( t ) );
+	if( it == t_tls_sessions->end() )
+	{
+		return ;
+	}
+	if( !SessionAlive( it->second ) )
+	{
+		SSL_SESSION_free( it->second );
+		t_tls_sessions->erase( it );
+		return ;
+	}
+	SSL_set_session( t->ssl,it->second );
+}
+
+void co_tls_session_flush()
+{
+	if( !t_tls_sessions )
+	{
+		return ;
+	}
+	for( CoTlsSessions_t::iterator it = t_tls_sessions->begin();it != t_tls_sessions->end();++it )
+	{
+		SSL_SESSION_free( it->second );
+	}
+	t_tls_sessions->clear();
+}
+
+stCoTls_t *co_tls_alloc( SSL_CTX *ctx,int fd,bool server )
+{
+	pthread_once( &g_tls_bio_once,InitTlsBioMethod );
+	if( !ctx || !g_tls_bio_method )
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	SSL *ssl = SSL_new( ctx );
+	BIO *bio = ssl ? BIO_new( g_tls_bio_method ) : NULL;
+	if( !bio )
+	{
+		SSL_free( ssl );
+		errno = ENOMEM;
+		return NULL;
+	}
+	stCoTls_t *t = new stCoTls_t();
+	t->ssl = ssl;
+	t->fd = fd;
+	t->bServer = server;
+	t->iErrno = 0;
+	t->rbuf = (char*)malloc( eTlsBufSize );
+	t->rhead = t->rtail = 0;
+	t->wbuf = (char*)malloc( eTlsBufSize );
+	t->wlen = 0;
+
+	BIO_set_data( bio,t );
+	BIO_set_init( bio,1 );
+	SSL_set_bio( ssl,bio,bio );
+	SSL_set_app_data( ssl,t );
+	if( server )
+	{
+		SSL_set_accept_state( ssl );
+	}
+	else
+	{
+		SSL_CTX_set_session_cache_mode( ctx,SSL_CTX_get_session_cache_mode( ctx ) | SSL_SESS_CACHE_CLIENT );
+		SSL_CTX_sess_set_new_cb( ctx,OnNewSession );
+		SSL_set_connect_state( ssl );
+	}
+	return t;
+}
+
+void co_tls_free( stCoTls_t *t )
+{
+	if( !t )
+	{
+		return ;
+	}
+	SSL_free( t->ssl ); //and the bio
+	free( t->rbuf );
+	free( t->wbuf );
+	delete t;
+}
+
+SSL *co_tls_ssl( stCoTls_t *t )
+{
+	return t->ssl;
+}
+int co_tls_fd( stCoTls_t *t )
+{
+	return t->fd;
+}
+
+int co_tls_set_hostname( stCoTls_t *t,const char *host )
+{
+	if( !host || SSL_set_tlsext_host_name( t->ssl,host ) != 1 || SSL_set1_host( t->ssl,host ) != 1 )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	t->sHost = host;
+	return 0;
+}
+
+//ssl result to -1 and errno,or 0 for a clean close
+static int TlsFailed( stCoTls_t *t,int ret )
+{
+	int err = SSL_get_error( t->ssl,ret );
+	switch( err )
+	{
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_SYSCALL:
+			//a bare eof under ssl is a reset,not a close
+			errno = t->iErrno ? t->iErrno : ECONNRESET;
+			return -1;
+	}
+#if defined( SSL_R_UNEXPECTED_EOF_WHILE_READING )
+	if( ERR_GET_REASON( ERR_peek_error() ) == SSL_R_UNEXPECTED_EOF_WHILE_READING )
+	{
+		errno = ECONNRESET; //openssl 3 calls it a protocol error
+		return -1;
+	}
+#endif
+	errno = EPROTO;
+	return -1;
+}
+
+int co_tls_handshake( stCoTls_t *t )
+{
+	if( !t->bServer && SSL_in_before( t->ssl ) )
+	{
+		ResumeSession( t );
+	}
+	ERR_clear_error();
+	t->iErrno = 0;
+	int ret = SSL_do_handshake( t->ssl );
+	if( ret == 1 )
+	{
+		return FlushTls( t );
+	}
+	if( TlsFailed( t,ret ) == 0 )
+	{
+		errno = ECONNRESET;
+	}
+	return -1;
+}
+
+ssize_t co_tls_read( stCoTls_t *t,void *buf,size_t len )
+{
+	if( !len )
+	{
+		return 0;
+	}
+	ERR_clear_error();
+	t->iErrno = 0;
+	int ret = SSL_read( t->ssl,buf,len > INT_MAX ? INT_MAX : (int)len );
+	if( ret > 0 )
+	{
+		return ret;
+	}
+	return TlsFailed( t,ret );
+}
+
+ssize_t co_tls_write( stCoTls_t *t,const void *buf,size_t len )
+{
+	if( !len )
+	{
+		return 0;
+	}
+	ERR_clear_error();
+	t->iErrno = 0;
+	int ret = SSL_write( t->ssl,buf,len > INT_MAX ? INT_MAX : (int)len );
+	if( ret <= 0 )
+	{
+		if( TlsFailed( t,ret ) == 0 )
+		{
+			errno = EPIPE;
+		}
+		return -1;
+	}
+	FlushTls( t );
+	return ret;
+}
+
+int co_tls_flush( stCoTls_t *t )
+{
+	return FlushTls( t );
+}
+
+int co_tls_shutdown( stCoTls_t *t )
+{
+	ERR_clear_error();
+	t->iErrno = 0;
+	int ret = SSL_shutdown( t->ssl );
+	if( ret < 0 )
+	{
+		TlsFailed( t,ret );
+		return -1;
+	}
+	return FlushTls( t );
+}
@@ -0,0 +1,56 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#ifndef __CO_TLS_H__
+#define __CO_TLS_H__
+
+#include <sys/types.h>
+#include <openssl/ssl.h>
+
+//tls over a socket of the hooked path,only built when openssl ( >= 1.1 ) is found.
+//the ssl object reads and writes through a bio on the hooked read/write: it parks
+//instead of spinning on WANT_READ,its small reads are served from one buffer and
+//the records of a handshake flight leave in one write.
+//
+//errors are -1 with errno:
+//EAGAIN	the fd's SO_RCVTIMEO/SO_SNDTIMEO ran out ( or O_NONBLOCK ),call again with
+//		the same arguments
+//EPROTO	tls failure,details on the openssl error queue
+//others	from the socket,ETIMEDOUT for the routine deadline
+struct stCoTls_t;
+
+//client ctxs get a session cache per loop,keyed by ctx,hostname and peer address,
+//co_tls_alloc installs its new session callback on ctx.
+//servers resume through ctx's own cache or tickets.
+stCoTls_t *	co_tls_alloc( SSL_CTX *ctx,int fd,bool server );
+void 	co_tls_free( stCoTls_t *t ); //neither shuts down nor closes fd
+SSL *	co_tls_ssl( stCoTls_t *t );
+int 	co_tls_fd( stCoTls_t *t );
+int 	co_tls_set_hostname( stCoTls_t *t,const char *host ); //sni and certificate check,before the handshake
+
+int 	co_tls_handshake( stCoTls_t *t );
+ssize_t co_tls_read( stCoTls_t *t,void *buf,size_t len ); //0 on close_notify
+//records are buffered and sent before co_tls_write returns; when that send fails
+//the data is taken anyway and goes before any later read waits,co_tls_flush to know
+ssize_t co_tls_write( stCoTls_t *t,const void *buf,size_t len );
+int 	co_tls_flush( stCoTls_t *t );
+int 	co_tls_shutdown( stCoTls_t *t ); //sends close_notify
+
+void 	co_tls_session_flush(); //drop this loop's cached sessions
+
+#endif
@@ -0,0 +1,243 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <map>
+#include <set>
+
+//each thread writes only its own ring,rings are chained into a global
+//list with a CAS push and never freed,so neither side takes a lock.
+struct stTraceEvent_t
+{
+	unsigned long long ullTs; //ns
+	unsigned long long ullId; //routine
+	const char *pszName;
+	long lArg1;
+	long lArg2;
+	int iType;
+};
+struct stTraceRing_t
+{
+	stTraceRing_t *pNext;
+	int iTid;
+	int iCap;
+	unsigned int iGen;
+	unsigned long long ullPos; //events written,published with release
+	stTraceEvent_t *pEvents;
+};
+
+int g_co_trace_on = 0;
+static unsigned int g_trace_gen = 0;
+static int g_trace_cap = 0;
+static stTraceRing_t *g_trace_rings = NULL;
+static __thread stTraceRing_t *t_trace_ring = NULL;
+
+static unsigned long long GetTraceNs()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC,&ts );
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static stTraceRing_t *GetTraceRing()
+{
+	unsigned int gen = __atomic_load_n( &g_trace_gen,__ATOMIC_ACQUIRE );
+	stTraceRing_t *ring = t_trace_ring;
+	if( ring && ring->iGen == gen )
+	{
+		return ring;
+	}
+	int cap = g_trace_cap;
+	if( !ring || ring->iCap < cap )
+	{
+		//an outgrown ring stays in the list,marked stale
+		if( ring )
+		{
+			__atomic_store_n( &ring->iGen,0,__ATOMIC_RELEASE );
+		}
+		ring = (stTraceRing_t*)calloc( 1,sizeof(stTraceRing_t) );
+		if( !ring )
+		{
+			return NULL;
+		}
+		ring->pEvents = (stTraceEvent_t*)calloc( cap,sizeof(stTraceEvent_t) );
+		if( !ring->pEvents )
+		{
+			free( ring );
+			return NULL;
+		}
+		ring->iCap = cap;
+		ring->iTid = syscall( SYS_gettid );
+		ring->pNext = __atomic_load_n( &g_trace_rings,__ATOMIC_RELAXED );
+		while( !__atomic_compare_exchange_n( &g_trace_rings,&ring->pNext,ring,true,
+					__ATOMIC_RELEASE,__ATOMIC_RELAXED ) )
+		{
+		}
+		t_trace_ring = ring;
+	}
+	__atomic_store_n( &ring->ullPos,0,__ATOMIC_RELEASE );
+	__atomic_store_n( &ring->iGen,gen,__ATOMIC_RELEASE );
+	return ring;
+}
+
+void co_trace_add( int type,unsigned long long id,const char *name,long arg1,long arg2 )
+{
+	stTraceRing_t *ring = GetTraceRing();
+	if( !ring )
+	{
+		return ;
+	}
+	if( !id )
+	{
+		stCoRoutine_t *co = GetCurrThreadCo();
+		id = co ? co->ullId : 0;
+	}
+	unsigned long long pos = ring->ullPos;
+	stTraceEvent_t *e = ring->pEvents + pos % ring->iCap;
+	e->ullTs = GetTraceNs();
+	e->ullId = id;
+	e->pszName = name;
+	e->lArg1 = arg1;
+	e->lArg2 = arg2;
+	e->iType = type;
+	__atomic_store_n( &ring->ullPos,pos + 1,__ATOMIC_RELEASE );
+}
+
+int co_trace_start( int events_per_thread )
+{
+	if( g_co_trace_on || events_per_thread <= 0 )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	g_trace_cap = events_per_thread;
+	unsigned int gen = g_trace_gen + 1;
+	if( !gen )
+	{
+		gen = 1; //0 marks stale rings
+	}
+	__atomic_store_n( &g_trace_gen,gen,__ATOMIC_RELEASE );
+	__atomic_store_n( &g_co_trace_on,1,__ATOMIC_RELEASE );
+	return 0;
+}
+void co_trace_stop()
+{
+	__atomic_store_n( &g_co_trace_on,0,__ATOMIC_RELEASE );
+}
+
+//chrome trace-event format: pid is the thread,tid the routine.
+//a routine's run slices are built from consecutive switch events.
+static void ExportRing( FILE *fp,stTraceRing_t *ring,bool &first )
+{
+	unsigned long long end = __atomic_load_n( &ring->ullPos,__ATOMIC_ACQUIRE );
+	unsigned long long begin = end > (unsigned long long)ring->iCap ? end - ring->iCap : 0;
+
+	std::map<unsigned long long,unsigned long long> run_since; //id -> switch-in ts
+	std::set<unsigned long long> ids;
+
+	for(unsigned long long pos=begin;pos<end;pos++)
+	{
+		const stTraceEvent_t &e = ring->pEvents[ pos % ring->iCap ];
+		double ts = e.ullTs / 1000.0;
+		ids.insert( e.ullId );
+		switch( e.iType )
+		{
+			case CO_TRACE_SWITCH:
+			{
+				unsigned long long to = (unsigned long long)e.lArg1;
+				ids.insert( to );
+				std::map<unsigned long long,unsigned long long>::iterator it = run_since.find( e.ullId );
+				if( it != run_since.end() )
+				{
+					fprintf( fp,"%s\n{\"name\":\"run\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f}",
+							first ? "" : ",",ring->iTid,e.ullId,it->second / 1000.0,( e.ullTs - it->second ) / 1000.0 );
+					first = false;
+					run_since.erase( it );
+				}
+				run_since[ to ] = e.ullTs;
+				break;
+			}
+			case CO_TRACE_WAKE:
+			case CO_TRACE_TIMER:
+			{
+				fprintf( fp,"%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,"
+						"\"args\":{\"%s\":%ld}}",
+						first ? "" : ",",e.pszName,ring->iTid,e.ullId,ts,
+						e.iType == CO_TRACE_WAKE ? "events" : "late_ms",e.lArg1 );
+				first = false;
+				break;
+			}
+			case CO_TRACE_SYS_ENTER:
+			case CO_TRACE_SYS_EXIT:
+			{
+				//async spans,since a call parks across many run slices
+				fprintf( fp,"%s\n{\"name\":\"%s\",\"cat\":\"sys\",\"ph\":\"%s\",\"id\":%llu,\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,"
+						"\"args\":{\"fd\":%ld",
+						first ? "" : ",",e.pszName,e.iType == CO_TRACE_SYS_ENTER ? "b" : "e",
+						e.ullId,ring->iTid,e.ullId,ts,e.lArg1 );
+				if( e.iType == CO_TRACE_SYS_EXIT )
+				{
+					fprintf( fp,",\"ret\":%ld",e.lArg2 );
+				}
+				fprintf( fp,"}}" );
+				first = false;
+				break;
+			}
+		}
+	}
+	for(std::set<unsigned long long>::iterator it = ids.begin();it != ids.end();++it)
+	{
+		fprintf( fp,"%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%llu,\"args\":{\"name\":\"routine %llu\"}}",
+				first ? "" : ",",ring->iTid,*it,*it );
+		first = false;
+	}
+}
+
+int co_trace_export( int fd )
+{
+	FILE *fp = fdopen( dup( fd ),"w" );
+	if( !fp )
+	{
+		return -1;
+	}
+	unsigned int gen = __atomic_load_n( &g_trace_gen,__ATOMIC_ACQUIRE );
+	bool first = true;
+	int cnt = 0;
+	fprintf( fp,"{\"traceEvents\":[" );
+	for(stTraceRing_t *ring = __atomic_load_n( &g_trace_rings,__ATOMIC_ACQUIRE );ring;ring = ring->pNext)
+	{
+		if( __atomic_load_n( &ring->iGen,__ATOMIC_ACQUIRE ) != gen )
+		{
+			continue;
+		}
+		ExportRing( fp,ring,first );
+		cnt++;
+	}
+	fprintf( fp,"\n],\"displayTimeUnit\":\"ns\"}\n" );
+	fclose( fp );
+	return cnt;
+}
@@ -0,0 +1,286 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+enum
+{
+	eMaxBatch = 64, //mmsghdr per syscall
+	eMaxGsoSegs = 64, //UDP_MAX_SEGMENTS of older kernels
+	eMaxUdpPayload = 65507, //one gso send is still one ip datagram
+};
+
+//sockets the kernel refused UDP_SEGMENT on,by fd,keyed by the socket's inode
+//so a later socket on the same fd starts over
+static unsigned long g_udp_gso_off[ 102400 ] = { 0 };
+
+static unsigned long UdpInode( int fd )
+{
+	struct stat st;
+	return fstat( fd,&st ) == 0 ? (unsigned long)st.st_ino : 0;
+}
+static bool IsGsoOff( int fd )
+{
+	if( fd < 0 || fd >= (int)( sizeof(g_udp_gso_off) / sizeof(g_udp_gso_off[0]) ) )
+	{
+		return false;
+	}
+	unsigned long ino = __atomic_load_n( &g_udp_gso_off[fd],__ATOMIC_RELAXED );
+	return ino && ino == UdpInode( fd );
+}
+static void SetGsoOff( int fd )
+{
+	if( fd >= 0 && fd < (int)( sizeof(g_udp_gso_off) / sizeof(g_udp_gso_off[0]) ) )
+	{
+		__atomic_store_n( &g_udp_gso_off[fd],UdpInode( fd ),__ATOMIC_RELAXED );
+	}
+}
+
+static int WaitUdp( int fd,short events,int timeout_ms )
+{
+	struct pollfd pf = { 0 };
+	pf.fd = fd;
+	pf.events = events | POLLERR | POLLHUP;
+	return co_poll( co_get_epoll_ct(),&pf,1,timeout_ms );
+}
+
+int co_udp_recv_batch( int fd,stCoDatagram_t *dgrams,int cnt,int timeout_ms )
+{
+	if( cnt > eMaxBatch )
+	{
+		cnt = eMaxBatch;
+	}
+	struct mmsghdr msgs[ eMaxBatch ];
+	struct iovec iovs[ eMaxBatch ];
+	char ctrl[ eMaxBatch ][ CMSG_SPACE( sizeof(int) ) ];
+
+	memset( msgs,0,sizeof(msgs[0]) * cnt );
+	for(int i=0;i<cnt;i++)
+	{
+		iovs[i].iov_base = dgrams[i].buf;
+		iovs[i].iov_len = dgrams[i].len;
+
+		struct msghdr &h = msgs[i].msg_hdr;
+		h.msg_name = &dgrams[i].addr;
+		h.msg_namelen = sizeof(dgrams[i].addr);
+		h.msg_iov = iovs + i;
+		h.msg_iovlen = 1;
+		h.msg_control = ctrl[i];
+		h.msg_controllen = sizeof(ctrl[i]);
+	}
+	for(;;)
+	{
+		int ret = recvmmsg( fd,msgs,cnt,MSG_DONTWAIT,NULL );
+		if( ret > 0 )
+		{
+			for(int i=0;i<ret;i++)
+			{
+				struct msghdr &h = msgs[i].msg_hdr;
+				dgrams[i].len = msgs[i].msg_len;
+				dgrams[i].addrlen = h.msg_namelen;
+				dgrams[i].segsize = 0;
+				for(struct cmsghdr *c = CMSG_FIRSTHDR( &h );c;c = CMSG_NXTHDR( &h,c ))
+				{
+					if( c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO )
+					{
+						memcpy( &dgrams[i].segsize,CMSG_DATA( c ),sizeof(int) );
+					}
+				}
+			}
+			return ret;
+		}
+		if( ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+		{
+			return -1;
+		}
+		ret = WaitUdp( fd,POLLIN,timeout_ms );
+		if( ret <= 0 )
+		{
+			return ret; //0 on timeout
+		}
+	}
+}
+
+int co_udp_send_batch( int fd,const stCoDatagram_t *dgrams,int cnt,int timeout_ms )
+{
+	int sent = 0;
+	while( sent < cnt )
+	{
+		int n = cnt - sent;
+		if( n > eMaxBatch )
+		{
+			n = eMaxBatch;
+		}
+		struct mmsghdr msgs[ eMaxBatch ];
+		struct iovec iovs[ eMaxBatch ];
+		memset( msgs,0,sizeof(msgs[0]) * n );
+		for(int i=0;i<n;i++)
+		{
+			const stCoDatagram_t &d = dgrams[ sent + i ];
+			iovs[i].iov_base = d.buf;
+			iovs[i].iov_len = d.len;
+
+			struct msghdr &h = msgs[i].msg_hdr;
+			h.msg_name = d.addrlen ? (void*)&d.addr : NULL;
+			h.msg_namelen = d.addrlen;
+			h.msg_iov = iovs + i;
+			h.msg_iovlen = 1;
+		}
+		int ret = sendmmsg( fd,msgs,n,MSG_DONTWAIT );
+		if( ret > 0 )
+		{
+			sent += ret;
+			continue;
+		}
+		if( ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS && errno != EINTR )
+		{
+			break;
+		}
+		if( WaitUdp( fd,POLLOUT,timeout_ms ) <= 0 )
+		{
+			break;
+		}
+	}
+	return sent ? sent : -1;
+}
+
+int co_udp_enable_gro( int fd )
+{
+	int on = 1;
+	return setsockopt( fd,SOL_UDP,UDP_GRO,&on,sizeof(on) );
+}
+
+//send len bytes as datagrams of segsize,one syscall per eMaxGsoSegs segments
+//or 64k of payload,whichever is less
+int co_udp_send_gso( int fd,const void *buf,size_t len,int segsize,
+		const struct sockaddr *addr,socklen_t addrlen )
+{
+	//the fallback copies addr into a stCoDatagram_t
+	if( segsize <= 0 || segsize > eMaxUdpPayload
+		|| ( addr && addrlen > (socklen_t)sizeof(struct sockaddr_storage) ) )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	int segs = eMaxUdpPayload / segsize;
+	if( segs > eMaxGsoSegs )
+	{
+		segs = eMaxGsoSegs;
+	}
+	const char *p = (const char*)buf;
+	size_t off = 0;
+	bool gso = !IsGsoOff( fd );
+	while( off < len && gso )
+	{
+		size_t chunk = len - off;
+		if( chunk > (size_t)segsize * segs )
+		{
+			chunk = (size_t)segsize * segs;
+		}
+		struct iovec iov = { (void*)( p + off ),chunk };
+		char ctrl[ CMSG_SPACE( sizeof(uint16_t) ) ];
+		memset( ctrl,0,sizeof(ctrl) );
+
+		struct msghdr h;
+		memset( &h,0,sizeof(h) );
+		h.msg_name = (void*)addr;
+		h.msg_namelen = addrlen;
+		h.msg_iov = &iov;
+		h.msg_iovlen = 1;
+		if( chunk > (size_t)segsize )
+		{
+			h.msg_control = ctrl;
+			h.msg_controllen = sizeof(ctrl);
+			struct cmsghdr *c = CMSG_FIRSTHDR( &h );
+			c->cmsg_level = SOL_UDP;
+			c->cmsg_type = UDP_SEGMENT;
+			c->cmsg_len = CMSG_LEN( sizeof(uint16_t) );
+			uint16_t seg = segsize;
+			memcpy( CMSG_DATA( c ),&seg,sizeof(seg) );
+		}
+		ssize_t ret = sendmsg( fd,&h,MSG_DONTWAIT );
+		if( ret >= 0 )
+		{
+			off += chunk;
+			continue;
+		}
+		if( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS )
+		{
+			if( WaitUdp( fd,POLLOUT,-1 ) < 0 )
+			{
+				return off ? (int)off : -1;
+			}
+			continue;
+		}
+		if( h.msg_control && ( errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP ) )
+		{
+			SetGsoOff( fd ); //no gso on this socket's kernel or device
+			gso = false;
+			break;
+		}
+		if( h.msg_control && errno == EINVAL )
+		{
+			gso = false; //segsize over the path mtu,segment this call by hand
+			break;
+		}
+		return off ? (int)off : -1;
+	}
+	while( off < len )
+	{
+		stCoDatagram_t dgrams[ eMaxBatch ];
+		size_t start = off;
+		int n = 0;
+		while( n < eMaxBatch && off < len )
+		{
+			size_t seg = len - off < (size_t)segsize ? len - off : (size_t)segsize;
+			dgrams[n].buf = (void*)( p + off );
+			dgrams[n].len = seg;
+			dgrams[n].addrlen = addr ? addrlen : 0;
+			if( addr )
+			{
+				memcpy( &dgrams[n].addr,addr,addrlen );
+			}
+			off += seg;
+			n++;
+		}
+		int ret = co_udp_send_batch( fd,dgrams,n,-1 );
+		if( ret != n )
+		{
+			off = start;
+			for(int i=0;i<ret;i++)
+			{
+				off += dgrams[i].len;
+			}
+			return off ? (int)off : -1;
+		}
+	}
+	return (int)len;
+}
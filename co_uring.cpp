@@ -0,0 +1,375 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+//io_uring through raw syscalls,no liburing.
+//each loop owns a ring: routines queue sqes and park,co_eventloop submits
+//them all with one io_uring_enter before it waits,and the ring's eventfd
+//brings the loop back to reap cqes.
+//without <linux/io_uring.h> or a kernel ring,calls go to co_run_blocking.
+#if defined( __has_include )
+#if __has_include( <linux/io_uring.h> ) && defined( __NR_io_uring_setup )
+#include <linux/io_uring.h>
+#define __LIBCO_URING__ 1
+#endif
+#endif
+
+//the real syscalls: pread/pwrite/fsync are hooked and would come back here
+struct stCoFileCall_t
+{
+	int iOp;
+	int fd;
+	void *buf;
+	size_t count;
+	off_t offset;
+	ssize_t ret;
+};
+enum
+{
+	eFileRead = 1,
+	eFileWrite,
+	eFileSync,
+};
+static ssize_t FileCall( stCoFileCall_t *c )
+{
+	switch( c->iOp )
+	{
+		case eFileRead: return syscall( SYS_pread64,c->fd,c->buf,c->count,c->offset );
+		case eFileWrite: return syscall( SYS_pwrite64,c->fd,c->buf,c->count,c->offset );
+		case eFileSync: return syscall( SYS_fsync,c->fd );
+	}
+	errno = EINVAL;
+	return -1;
+}
+static void *BlockingFileCall( void *arg )
+{
+	stCoFileCall_t *c = (stCoFileCall_t*)arg;
+	c->ret = FileCall( c );
+	return NULL;
+}
+
+#if defined( __LIBCO_URING__ )
+
+enum
+{
+	eUringEntries = 256,
+};
+struct stCoUringOp_t
+{
+	stCoRoutine_t *co;
+	struct iovec iov;
+	int res;
+	bool bDone;
+};
+struct stCoUring_t
+{
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	unsigned iToSubmit; //queued since the last io_uring_enter
+	stCoWakeup_t *wakeup;
+};
+static __thread stCoUring_t *t_uring = NULL;
+static __thread bool t_uring_off = false; //setup failed once,use the pool
+
+static void OnUringWakeup( void *arg );
+
+static stCoUring_t *SetupUring()
+{
+	struct io_uring_params p;
+	memset( &p,0,sizeof(p) );
+	int fd = syscall( __NR_io_uring_setup,eUringEntries,&p );
+	if( fd < 0 )
+	{
+		return NULL;
+	}
+	size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if( p.features & IORING_FEAT_SINGLE_MMAP )
+	{
+		sq_len = cq_len = sq_len > cq_len ? sq_len : cq_len;
+	}
+	char *sq = (char*)mmap( NULL,sq_len,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,fd,IORING_OFF_SQ_RING );
+	char *cq = sq;
+	if( sq != MAP_FAILED && !( p.features & IORING_FEAT_SINGLE_MMAP ) )
+	{
+		cq = (char*)mmap( NULL,cq_len,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,fd,IORING_OFF_CQ_RING );
+	}
+	void *sqes = MAP_FAILED;
+	if( sq != MAP_FAILED && cq != MAP_FAILED )
+	{
+		sqes = mmap( NULL,p.sq_entries * sizeof(struct io_uring_sqe),PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE,fd,IORING_OFF_SQES );
+	}
+	if( sqes == MAP_FAILED )
+	{
+		//the ring is per thread and lives as long as it,only setup unwinds
+		if( cq != MAP_FAILED && cq != sq )
+		{
+			munmap( cq,cq_len );
+		}
+		if( sq != MAP_FAILED )
+		{
+			munmap( sq,sq_len );
+		}
+		close( fd );
+		return NULL;
+	}
+
+	stCoUring_t *ring = (stCoUring_t*)calloc( 1,sizeof(stCoUring_t) );
+	ring->fd = fd;
+	ring->sq_head = (unsigned*)( sq + p.sq_off.head );
+	ring->sq_tail = (unsigned*)( sq + p.sq_off.tail );
+	ring->sq_mask = *(unsigned*)( sq + p.sq_off.ring_mask );
+	ring->sq_entries = p.sq_entries;
+	ring->sq_array = (unsigned*)( sq + p.sq_off.array );
+	ring->sqes = (struct io_uring_sqe*)sqes;
+	ring->cq_head = (unsigned*)( cq + p.cq_off.head );
+	ring->cq_tail = (unsigned*)( cq + p.cq_off.tail );
+	ring->cq_mask = *(unsigned*)( cq + p.cq_off.ring_mask );
+	ring->cqes = (struct io_uring_cqe*)( cq + p.cq_off.cqes );
+
+	ring->wakeup = co_wakeup_alloc( co_get_epoll_ct(),OnUringWakeup,ring );
+	int efd = ring->wakeup ? co_wakeup_fd( ring->wakeup ) : -1;
+	if( efd < 0 || syscall( __NR_io_uring_register,fd,IORING_REGISTER_EVENTFD,&efd,1 ) < 0 )
+	{
+		if( ring->wakeup )
+		{
+			co_wakeup_free( ring->wakeup );
+		}
+		free( ring );
+		munmap( sqes,p.sq_entries * sizeof(struct io_uring_sqe) );
+		if( cq != sq )
+		{
+			munmap( cq,cq_len );
+		}
+		munmap( sq,sq_len );
+		close( fd );
+		return NULL;
+	}
+	return ring;
+}
+
+static stCoUring_t *GetUring()
+{
+	if( !t_uring && !t_uring_off )
+	{
+		t_uring = SetupUring();
+		t_uring_off = !t_uring;
+	}
+	return t_uring;
+}
+
+static void SubmitUring( stCoUring_t *ring )
+{
+	while( ring->iToSubmit )
+	{
+		int ret = syscall( __NR_io_uring_enter,ring->fd,ring->iToSubmit,0,0,NULL,0 );
+		if( ret <= 0 )
+		{
+			break; //EAGAIN/EBUSY,the next lap tries again
+		}
+		ring->iToSubmit -= ret;
+	}
+}
+
+static void ReapUring( stCoUring_t *ring )
+{
+	unsigned head = *ring->cq_head;
+	while( head != __atomic_load_n( ring->cq_tail,__ATOMIC_ACQUIRE ) )
+	{
+		struct io_uring_cqe *cqe = ring->cqes + ( head & ring->cq_mask );
+		stCoUringOp_t *op = (stCoUringOp_t*)(uintptr_t)cqe->user_data;
+		op->res = cqe->res;
+		op->bDone = true;
+		head++;
+		__atomic_store_n( ring->cq_head,head,__ATOMIC_RELEASE );
+
+		co_resume( op->co );
+		head = *ring->cq_head;
+	}
+}
+static void OnUringWakeup( void *arg )
+{
+	ReapUring( (stCoUring_t*)arg );
+}
+
+//called by co_eventloop before it waits
+void co_uring_flush()
+{
+	if( t_uring && t_uring->iToSubmit )
+	{
+		SubmitUring( t_uring );
+	}
+}
+
+static ssize_t UringCall( stCoUring_t *ring,stCoFileCall_t *c )
+{
+	unsigned tail = *ring->sq_tail;
+	if( tail - __atomic_load_n( ring->sq_head,__ATOMIC_ACQUIRE ) >= ring->sq_entries )
+	{
+		SubmitUring( ring );
+		if( tail - __atomic_load_n( ring->sq_head,__ATOMIC_ACQUIRE ) >= ring->sq_entries )
+		{
+			co_run_blocking( BlockingFileCall,c );
+			return c->ret;
+		}
+	}
+	stCoUringOp_t *op = (stCoUringOp_t*)calloc( 1,sizeof(stCoUringOp_t) );
+	op->co = co_self();
+	op->iov.iov_base = c->buf;
+	op->iov.iov_len = c->count;
+
+	unsigned idx = tail & ring->sq_mask;
+	struct io_uring_sqe *sqe = ring->sqes + idx;
+	memset( sqe,0,sizeof(*sqe) );
+	sqe->fd = c->fd;
+	sqe->user_data = (uintptr_t)op;
+	switch( c->iOp )
+	{
+		case eFileRead:
+		case eFileWrite:
+			//the vectored ops go back to the first io_uring kernels
+			sqe->opcode = c->iOp == eFileRead ? IORING_OP_READV : IORING_OP_WRITEV;
+			sqe->addr = (uintptr_t)&op->iov;
+			sqe->len = 1;
+			sqe->off = c->offset;
+			break;
+		case eFileSync:
+			sqe->opcode = IORING_OP_FSYNC;
+			break;
+	}
+	ring->sq_array[ idx ] = idx;
+	__atomic_store_n( ring->sq_tail,tail + 1,__ATOMIC_RELEASE );
+	ring->iToSubmit++;
+
+	//not cancellable: the kernel owns buf until the cqe
+	op->co->cWaitReason = CO_WAIT_BLOCKING;
+	while( !op->bDone )
+	{
+		co_yield_env( co_get_curr_thread_env() );
+	}
+	op->co->cWaitReason = CO_WAIT_NONE;
+
+	int res = op->res;
+	free( op );
+	if( res < 0 )
+	{
+		errno = -res;
+		return -1;
+	}
+	return res;
+}
+
+#else
+
+void co_uring_flush()
+{
+}
+
+#endif
+
+static ssize_t ParkFileCall( stCoFileCall_t *c )
+{
+#if defined( __LIBCO_URING__ )
+	stCoUring_t *ring = GetUring();
+	if( ring )
+	{
+		return UringCall( ring,c );
+	}
+#endif
+	co_run_blocking( BlockingFileCall,c );
+	return c->ret;
+}
+static ssize_t CoFileCall( stCoFileCall_t *c )
+{
+	stCoRoutine_t *self = co_self();
+	if( !self || self->cIsMain )
+	{
+		return FileCall( c );
+	}
+	if( !self->cIsShareStack )
+	{
+		return ParkFileCall( c );
+	}
+	//a shared stack is swapped out while we park,the kernel and the pool
+	//may only touch the heap: bounce the call,and its data if it is on the stack
+	const char *lo = self->stack_mem->stack_buffer;
+	const char *hi = self->stack_mem->stack_bp;
+	bool onstack = c->buf && (const char*)c->buf < hi && (const char*)c->buf + c->count > lo;
+	stCoFileCall_t *h = (stCoFileCall_t*)malloc( sizeof(stCoFileCall_t) + ( onstack ? c->count : 0 ) );
+	if( !h )
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	*h = *c;
+	if( onstack )
+	{
+		h->buf = h + 1;
+		if( c->iOp == eFileWrite )
+		{
+			memcpy( h->buf,c->buf,c->count );
+		}
+	}
+	ssize_t ret = ParkFileCall( h );
+	int err = errno;
+	if( onstack && c->iOp == eFileRead && ret > 0 )
+	{
+		memcpy( c->buf,h->buf,ret );
+	}
+	free( h );
+	errno = err;
+	return ret;
+}
+
+ssize_t co_pread( int fd,void *buf,size_t count,off_t offset )
+{
+	stCoFileCall_t c = { eFileRead,fd,buf,count,offset,0 };
+	return CoFileCall( &c );
+}
+ssize_t co_pwrite( int fd,const void *buf,size_t count,off_t offset )
+{
+	stCoFileCall_t c = { eFileWrite,fd,(void*)buf,count,offset,0 };
+	return CoFileCall( &c );
+}
+int co_fsync( int fd )
+{
+	stCoFileCall_t c = { eFileSync,fd,NULL,0,0,0 };
+	return CoFileCall( &c );
+}
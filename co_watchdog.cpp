@@ -0,0 +1,209 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); 
+* you may not use this file except in compliance with the License. 
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, 
+* software distributed under the License is distributed on an "AS IS" BASIS, 
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+* See the License for the specific language governing permissions and 
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <vector>
+
+struct stWatchEnv_t
+{
+	stCoRoutineEnv_t *env;
+	pthread_t tid;
+
+	unsigned long long ullLastBeat;
+	unsigned long long ullLastChange; //ms
+	char cReported;
+};
+
+static pthread_mutex_t g_watch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<stWatchEnv_t> g_watch_envs;
+
+static pthread_t g_watch_tid;
+static volatile int g_watch_running = 0;
+static int g_watch_threshold = 0;
+static int g_watch_fd = -1;
+static int g_watch_signo = 0;
+
+static unsigned long long GetMonoMS()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC,&ts );
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void co_watchdog_add_env( stCoRoutineEnv_t *env )
+{
+	stWatchEnv_t w;
+	memset( &w,0,sizeof(w) );
+	w.env = env;
+	w.tid = pthread_self();
+	w.ullLastChange = GetMonoMS();
+
+	pthread_mutex_lock( &g_watch_mutex );
+	g_watch_envs.push_back( w );
+	pthread_mutex_unlock( &g_watch_mutex );
+}
+void co_watchdog_del_env( stCoRoutineEnv_t *env )
+{
+	pthread_mutex_lock( &g_watch_mutex );
+	for(size_t i=0;i<g_watch_envs.size();i++)
+	{
+		if( g_watch_envs[i].env == env )
+		{
+			g_watch_envs.erase( g_watch_envs.begin() + i );
+			break;
+		}
+	}
+	pthread_mutex_unlock( &g_watch_mutex );
+}
+
+//runs on the stalled thread
+static void OnWatchdogSignal( int )
+{
+	int saved = errno;
+
+	stCoRoutineEnv_t *env = co_get_curr_thread_env();
+	unsigned long long id = 0;
+	if( env && env->iCallStackSize > 0 )
+	{
+		id = env->pCallStack[ env->iCallStackSize - 1 ]->ullId;
+	}
+	char buf[128];
+	int len = snprintf( buf,sizeof(buf),"co_watchdog: backtrace of routine %llu\n",id );
+	if( write( g_watch_fd,buf,len ) < 0 )
+	{
+	}
+	void *frames[ 64 ];
+	int n = backtrace( frames,sizeof(frames) / sizeof(frames[0]) );
+	backtrace_symbols_fd( frames,n,g_watch_fd );
+
+	errno = saved;
+}
+
+static void CheckEnv( stWatchEnv_t &w,unsigned long long now )
+{
+	unsigned long long beat = __atomic_load_n( &w.env->ullHeartbeat,__ATOMIC_RELAXED );
+	if( beat != w.ullLastBeat )
+	{
+		w.ullLastBeat = beat;
+		w.ullLastChange = now;
+		w.cReported = 0;
+		return ;
+	}
+	if( w.cReported || now - w.ullLastChange < (unsigned long long)g_watch_threshold )
+	{
+		return ;
+	}
+	w.cReported = 1;
+
+	//the loop thread is stuck,so its call stack is stable enough to peek
+	stCoRoutineEnv_t *env = w.env;
+	int size = env->iCallStackSize;
+	stCoRoutine_t *co = size > 0 ? env->pCallStack[ size - 1 ] : NULL;
+
+	char buf[256];
+	int len = snprintf( buf,sizeof(buf),
+			"co_watchdog: routine %llu co %p pfn %p arg %p%s running %llu ms without switching\n",
+			co ? co->ullId : 0,co,co ? (void*)co->pfn : NULL,co ? co->arg : NULL,
+			( co && co->cIsMain ) ? " (main)" : "",now - w.ullLastChange );
+	if( write( g_watch_fd,buf,len ) < 0 )
+	{
+	}
+	if( g_watch_signo )
+	{
+		pthread_kill( w.tid,g_watch_signo );
+	}
+}
+static void *WatchdogRoutine( void * )
+{
+	int interval_ms = g_watch_threshold / 4;
+	if( interval_ms < 1 )
+	{
+		interval_ms = 1;
+	}
+	while( g_watch_running )
+	{
+		struct timespec ts = { interval_ms / 1000,( interval_ms % 1000 ) * 1000000 };
+		nanosleep( &ts,NULL );
+
+		unsigned long long now = GetMonoMS();
+		pthread_mutex_lock( &g_watch_mutex );
+		for(size_t i=0;i<g_watch_envs.size();i++)
+		{
+			CheckEnv( g_watch_envs[i],now );
+		}
+		pthread_mutex_unlock( &g_watch_mutex );
+	}
+	return NULL;
+}
+
+int co_watchdog_start( int threshold_ms,int report_fd,int signo )
+{
+	if( g_watch_running || threshold_ms <= 0 || report_fd < 0 )
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	g_watch_threshold = threshold_ms;
+	g_watch_fd = report_fd;
+	g_watch_signo = signo;
+
+	if( signo )
+	{
+		//the first backtrace may malloc while loading the unwinder
+		void *frames[ 1 ];
+		backtrace( frames,1 );
+
+		struct sigaction sa;
+		memset( &sa,0,sizeof(sa) );
+		sa.sa_handler = OnWatchdogSignal;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset( &sa.sa_mask );
+		if( sigaction( signo,&sa,NULL ) < 0 )
+		{
+			return -1;
+		}
+	}
+	g_watch_running = 1;
+	int ret = pthread_create( &g_watch_tid,NULL,WatchdogRoutine,NULL );
+	if( ret )
+	{
+		g_watch_running = 0;
+		errno = ret;
+		return -1;
+	}
+	return 0;
+}
+void co_watchdog_stop()
+{
+	if( !g_watch_running )
+	{
+		return ;
+	}
+	g_watch_running = 0;
+	pthread_join( g_watch_tid,NULL );
+}
@@ -0,0 +1,393 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_routine_inner.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <time.h>
+#include <map>
+#include <vector>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+//one co_zerocopy_send* call.the kernel numbers every MSG_ZEROCOPY send
+//on a socket,a request owns the contiguous range [first,first + cnt).
+struct stCoZcReq_t
+{
+	unsigned int iFirst;
+	unsigned int iCnt;
+	unsigned int iDone;
+
+	const void *buf;
+	size_t len;
+	pfn_co_zerocopy_done_t pfnDone;
+	void *arg;
+	bool bSending; //iCnt still growing
+	bool bDone;
+};
+struct stCoZcSock_t
+{
+	int fd;
+	unsigned int iNextSeq;
+	bool bCopied; //kernel fell back to copying,eg. loopback
+	std::vector<stCoZcReq_t*> vecReq;
+	stCoCond_t *cond;
+};
+struct stCoZcThread_t
+{
+	std::map<int,stCoZcSock_t*> mapSock;
+	int iPending; //requests waiting for completions
+};
+static __thread stCoZcThread_t *t_zc = NULL;
+
+static stCoZcSock_t *GetZcSock( int fd )
+{
+	if( !t_zc )
+	{
+		return NULL;
+	}
+	std::map<int,stCoZcSock_t*>::iterator it = t_zc->mapSock.find( fd );
+	return it != t_zc->mapSock.end() ? it->second : NULL;
+}
+
+int co_zerocopy_enable( int fd )
+{
+	if( GetZcSock( fd ) )
+	{
+		return 0;
+	}
+	int on = 1;
+	if( setsockopt( fd,SOL_SOCKET,SO_ZEROCOPY,&on,sizeof(on) ) < 0 )
+	{
+		return -1;
+	}
+	if( !t_zc )
+	{
+		t_zc = new stCoZcThread_t();
+		t_zc->iPending = 0;
+	}
+	stCoZcSock_t *sock = new stCoZcSock_t();
+	sock->fd = fd;
+	sock->iNextSeq = 0;
+	sock->bCopied = false;
+	sock->cond = co_cond_alloc();
+	t_zc->mapSock[ fd ] = sock;
+	return 0;
+}
+
+static unsigned int GetOverlap( unsigned int lo,unsigned int hi,stCoZcReq_t *req )
+{
+	//sequence numbers wrap,compare as offsets from the request start
+	unsigned int cnt = 0;
+	for(unsigned int seq = lo;;seq++)
+	{
+		if( (unsigned int)( seq - req->iFirst ) < req->iCnt )
+		{
+			cnt++;
+		}
+		if( seq == hi )
+		{
+			break;
+		}
+	}
+	return cnt;
+}
+
+static void FinishReq( stCoZcSock_t *sock,stCoZcReq_t *req )
+{
+	req->bDone = true;
+	if( req->pfnDone )
+	{
+		req->pfnDone( req->buf,req->len,req->arg );
+		delete req;
+	}
+	//co_zerocopy_send frees its own
+	co_cond_broadcast( sock->cond );
+}
+
+//drain the error queue,return completions seen
+static int ReapSock( stCoZcSock_t *sock )
+{
+	int cnt = 0;
+	for(;;)
+	{
+		char ctrl[ 128 ];
+		struct msghdr msg;
+		memset( &msg,0,sizeof(msg) );
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+
+		if( recvmsg( sock->fd,&msg,MSG_ERRQUEUE | MSG_DONTWAIT ) < 0 )
+		{
+			break;
+		}
+		for(struct cmsghdr *c = CMSG_FIRSTHDR( &msg );c;c = CMSG_NXTHDR( &msg,c ))
+		{
+			if( !( ( c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR )
+				|| ( c->cmsg_level == SOL_IPV6 && c->cmsg_type == IPV6_RECVERR ) ) )
+			{
+				continue;
+			}
+			struct sock_extended_err ee;
+			memcpy( &ee,CMSG_DATA( c ),sizeof(ee) );
+			if( ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee.ee_errno != 0 )
+			{
+				continue;
+			}
+			if( ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED )
+			{
+				sock->bCopied = true;
+			}
+			unsigned int lo = ee.ee_info;
+			unsigned int hi = ee.ee_data;
+			cnt += hi - lo + 1;
+
+			for(size_t i=0;i<sock->vecReq.size();)
+			{
+				stCoZcReq_t *req = sock->vecReq[i];
+				req->iDone += GetOverlap( lo,hi,req );
+				if( !req->bSending && req->iDone >= req->iCnt )
+				{
+					sock->vecReq.erase( sock->vecReq.begin() + i );
+					t_zc->iPending--;
+					FinishReq( sock,req );
+					continue;
+				}
+				i++;
+			}
+		}
+	}
+	return cnt;
+}
+
+//called by co_eventloop every lap
+void co_zerocopy_reap()
+{
+	if( !t_zc || !t_zc->iPending )
+	{
+		return ;
+	}
+	for(std::map<int,stCoZcSock_t*>::iterator it = t_zc->mapSock.begin();it != t_zc->mapSock.end();++it)
+	{
+		if( !it->second->vecReq.empty() )
+		{
+			ReapSock( it->second );
+		}
+	}
+}
+
+//send everything,counting MSG_ZEROCOPY calls into req
+static ssize_t SendAll( stCoZcSock_t *sock,stCoZcReq_t *req,const char *buf,size_t len,int flags )
+{
+	size_t sent = 0;
+	bool zerocopy = true;
+	int timeout = co_hook_write_timeout( sock->fd ); //as long as the hooked write waits
+	while( sent < len )
+	{
+		//MSG_DONTWAIT keeps the hooked sendmsg from retrying on its own,
+		//every call must be counted
+		int zcflag = zerocopy ? MSG_ZEROCOPY : 0;
+		struct iovec iov = { (void*)( buf + sent ),len - sent };
+		struct msghdr msg;
+		memset( &msg,0,sizeof(msg) );
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		ssize_t ret = sendmsg( sock->fd,&msg,flags | zcflag | MSG_DONTWAIT );
+		if( ret > 0 )
+		{
+			sent += ret;
+			if( zcflag )
+			{
+				sock->iNextSeq++;
+				req->iCnt++;
+			}
+			continue;
+		}
+		if( ret < 0 && errno == ENOBUFS && zerocopy )
+		{
+			//out of optmem for pinned pages: reclaim,then copy the rest if still short
+			if( ReapSock( sock ) == 0 )
+			{
+				zerocopy = false;
+			}
+			continue;
+		}
+		if( ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR )
+		{
+			return sent ? (ssize_t)sent : -1;
+		}
+		struct pollfd pf = { 0 };
+		pf.fd = sock->fd;
+		pf.events = ( POLLOUT | POLLERR | POLLHUP );
+		int pollret = co_poll( co_get_epoll_ct(),&pf,1,timeout );
+		if( pollret < 0 )
+		{
+			return sent ? (ssize_t)sent : -1;
+		}
+		if( pollret == 0 )
+		{
+			errno = co_deadline_remaining() == 0 ? ETIMEDOUT : EAGAIN;
+			return sent ? (ssize_t)sent : -1;
+		}
+		if( pf.revents & POLLERR )
+		{
+			ReapSock( sock );
+		}
+	}
+	return sent;
+}
+
+static stCoZcReq_t *StartReq( stCoZcSock_t *sock,const void *buf,size_t len,
+		pfn_co_zerocopy_done_t done,void *arg )
+{
+	stCoZcReq_t *req = new stCoZcReq_t();
+	req->iFirst = sock->iNextSeq;
+	req->iCnt = 0;
+	req->iDone = 0;
+	req->buf = buf;
+	req->len = len;
+	req->pfnDone = done;
+	req->arg = arg;
+	req->bSending = true;
+	req->bDone = false;
+
+	//tracked from the start: completions may be reaped while we still send
+	sock->vecReq.push_back( req );
+	t_zc->iPending++;
+	return req;
+}
+static void EndSend( stCoZcSock_t *sock,stCoZcReq_t *req )
+{
+	req->bSending = false;
+	if( req->iDone < req->iCnt )
+	{
+		ReapSock( sock );
+		return ;
+	}
+	//every part was copied or already completed
+	for(size_t i=0;i<sock->vecReq.size();i++)
+	{
+		if( sock->vecReq[i] == req )
+		{
+			sock->vecReq.erase( sock->vecReq.begin() + i );
+			t_zc->iPending--;
+			break;
+		}
+	}
+	FinishReq( sock,req );
+}
+static void DropReq( const void *,size_t,void * )
+{
+}
+
+ssize_t co_zerocopy_send( int fd,const void *buf,size_t len,int flags )
+{
+	stCoZcSock_t *sock = GetZcSock( fd );
+	if( !sock || sock->bCopied || len < CO_ZEROCOPY_MIN_SIZE )
+	{
+		return send( fd,buf,len,flags );
+	}
+	stCoZcReq_t *req = StartReq( sock,buf,len,NULL,NULL );
+	ssize_t ret = SendAll( sock,req,(const char*)buf,len,flags );
+	EndSend( sock,req );
+
+	//the eventloop reaps every lap and wakes us
+	while( !req->bDone )
+	{
+		if( co_cond_timedwait( sock->cond,-1 ) < 0 )
+		{
+			//canceled or past the deadline,the wait no longer parks.
+			//the kernel still holds buf,leave the request to the reaper,
+			//what was queued goes out anyway
+			req->pfnDone = DropReq;
+			return ret > 0 ? ret : -1;
+		}
+	}
+	delete req;
+	return ret;
+}
+
+ssize_t co_zerocopy_send_async( int fd,const void *buf,size_t len,int flags,
+		pfn_co_zerocopy_done_t done,void *arg )
+{
+	stCoZcSock_t *sock = GetZcSock( fd );
+	if( !sock || sock->bCopied || len < CO_ZEROCOPY_MIN_SIZE )
+	{
+		ssize_t ret = send( fd,buf,len,flags );
+		done( buf,len,arg );
+		return ret;
+	}
+	stCoZcReq_t *req = StartReq( sock,buf,len,done,arg );
+	ssize_t ret = SendAll( sock,req,(const char*)buf,len,flags );
+	EndSend( sock,req ); //req may be done and freed here
+	return ret;
+}
+
+static unsigned long long GetZcTickMS()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC,&ts );
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int co_zerocopy_release( int fd,int timeout_ms )
+{
+	stCoZcSock_t *sock = GetZcSock( fd );
+	if( !sock )
+	{
+		return 0;
+	}
+	unsigned long long end = GetZcTickMS() + timeout_ms;
+	ReapSock( sock );
+	while( !sock->vecReq.empty() )
+	{
+		unsigned long long now = GetZcTickMS();
+		if( timeout_ms >= 0 && now >= end )
+		{
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		if( co_cond_timedwait( sock->cond,timeout_ms >= 0 ? (int)( end - now ) : -1 ) < 0 )
+		{
+			return -1; //ECANCELED or ETIMEDOUT for the deadline
+		}
+	}
+	t_zc->mapSock.erase( fd );
+	co_cond_free( sock->cond );
+	delete sock;
+	return 0;
+}
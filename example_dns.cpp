@@ -0,0 +1,175 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+//the resolver against a stub dns server on loopback:
+//svc.test has an A record with ttl 2,anything else is NXDOMAIN.
+//concurrent lookups share one query,repeats come from the cache.
+
+enum
+{
+	eClients = 8,
+};
+static int g_queries = 0;
+static int g_done = 0;
+
+static void* DnsServer(void* args)
+{
+	co_enable_hook_sys();
+	int fd = *(int*)args;
+	for (;;)
+	{
+		unsigned char buf[512];
+		struct sockaddr_in from;
+		socklen_t fromlen = sizeof(from);
+		int n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr*)&from, &fromlen);
+		if (n < 12)
+		{
+			continue;
+		}
+		g_queries++;
+
+		//question name,as text
+		char name[256] = { 0 };
+		int pos = 12;
+		while (pos < n && buf[pos])
+		{
+			if (name[0])
+			{
+				strcat(name, ".");
+			}
+			strncat(name, (char*)buf + pos + 1, buf[pos]);
+			pos += buf[pos] + 1;
+		}
+		int qtype = (buf[pos + 1] << 8) | buf[pos + 2];
+		int qend = pos + 5;
+		printf("server: query %d for %s type %d\n", g_queries, name, qtype);
+
+		poll(NULL, 0, 50); //a slow upstream
+
+		bool found = strcmp(name, "svc.test") == 0;
+		unsigned char reply[512];
+		memcpy(reply, buf, qend);
+		reply[2] = 0x81; //QR RD
+		reply[3] = 0x80 | (found ? 0 : 3); //RA,NXDOMAIN
+		memset(reply + 6, 0, 6);
+		int len = qend;
+		if (found && qtype == 1)
+		{
+			reply[7] = 1;
+			unsigned char rr[] = { 0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 2, 0, 4, 10, 0, 0, (unsigned char)g_queries };
+			memcpy(reply + len, rr, sizeof(rr));
+			len += sizeof(rr);
+		}
+		sendto(fd, reply, len, 0, (struct sockaddr*)&from, fromlen);
+	}
+	return NULL;
+}
+
+static void* Client(void* args)
+{
+	co_enable_hook_sys();
+	int id = *(int*)args;
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* res = NULL;
+	int ret = getaddrinfo("svc.test", "80", &hints, &res);
+	if (ret == 0)
+	{
+		char ip[INET_ADDRSTRLEN];
+		struct sockaddr_in* in = (struct sockaddr_in*)res->ai_addr;
+		printf("client %d: svc.test -> %s:%d\n", id, inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip)), ntohs(in->sin_port));
+		freeaddrinfo(res);
+	}
+	else
+	{
+		printf("client %d: %s\n", id, gai_strerror(ret));
+	}
+	g_done++;
+	return NULL;
+}
+
+static void* Main(void* args)
+{
+	co_enable_hook_sys();
+	while (g_done < eClients)
+	{
+		poll(NULL, 0, 10);
+	}
+	printf("%d concurrent lookups, %d queries\n", eClients, g_queries);
+
+	struct hostent* host = gethostbyname("svc.test");
+	printf("gethostbyname: %s, queries %d\n", host ? inet_ntoa(*(struct in_addr*)host->h_addr_list[0]) : "fail", g_queries);
+
+	struct addrinfo* res = NULL;
+	int ret = getaddrinfo("missing.test.", NULL, NULL, &res);
+	printf("missing.test: %s\n", ret ? gai_strerror(ret) : "found");
+
+	sleep(3); //past the ttl
+	host = gethostbyname("svc.test");
+	printf("after ttl: %s, queries %d\n", host ? inet_ntoa(*(struct in_addr*)host->h_addr_list[0]) : "fail", g_queries);
+	exit(0);
+	return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		printf("bind: %s\n", strerror(errno));
+		return -1;
+	}
+	socklen_t len = sizeof(addr);
+	getsockname(fd, (struct sockaddr*)&addr, &len);
+	alloc_by_fd(fd);
+	co_resolver_set_nameserver("127.0.0.1", ntohs(addr.sin_port));
+
+	stCoRoutine_t* co;
+	co_create(&co, NULL, DnsServer, &fd);
+	co_resume(co);
+
+	int ids[eClients];
+	for (int i = 0; i < eClients; i++)
+	{
+		ids[i] = i;
+		co_create(&co, NULL, Client, ids + i);
+		co_resume(co);
+	}
+	co_create(&co, NULL, Main, NULL);
+	co_resume(co);
+
+	co_eventloop(co_get_epoll_ct(), NULL, NULL);
+	return 0;
+}
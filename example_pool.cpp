@@ -0,0 +1,179 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+//many routines doing short rpcs to one echo server through a pool of at most
+//4 connections. then the pool sits idle past its idle timeout down to
+//min_idle_per_dest,and after the server drops everything the background
+//check finds the dead connections and reconnects.
+
+enum
+{
+	eClients = 32,
+	eRequests = 50,
+};
+static struct sockaddr_in g_addr;
+static stCoPool_t* g_pool = NULL;
+static int g_done = 0;
+static int g_generation = 0; //bump to have the server drop its connections
+
+static void* Session(void* args)
+{
+	co_enable_hook_sys();
+	int fd = (int)(long)args;
+	int generation = g_generation;
+	while (generation == g_generation)
+	{
+		struct pollfd pf = { fd, POLLIN, 0 };
+		if (poll(&pf, 1, 100) == 0)
+		{
+			continue;
+		}
+		char buf[128];
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n <= 0)
+		{
+			break;
+		}
+		write(fd, buf, n);
+	}
+	close(fd);
+	return NULL;
+}
+
+static void* Accept(void* args)
+{
+	co_enable_hook_sys();
+	int listen_fd = *(int*)args;
+	for (;;)
+	{
+		struct pollfd pf = { listen_fd, POLLIN, 0 };
+		if (poll(&pf, 1, 1000) <= 0)
+		{
+			continue; //listen_fd blocks,accept only when it is ready
+		}
+		//nonblocking underneath,the hooked read/write do the waiting
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0)
+		{
+			continue;
+		}
+		alloc_by_fd(fd);
+		stCoRoutine_t* co;
+		co_create(&co, NULL, Session, (void*)(long)fd);
+		co_resume(co);
+	}
+	return NULL;
+}
+
+static void* Client(void* args)
+{
+	co_enable_hook_sys();
+	int id = *(int*)args;
+	for (int i = 0; i < eRequests; i++)
+	{
+		int fd = co_pool_borrow(g_pool, (struct sockaddr*)&g_addr, sizeof(g_addr), 1000);
+		if (fd < 0)
+		{
+			printf("client %d: borrow: %s\n", id, strerror(errno));
+			continue;
+		}
+		char req[32], rsp[32];
+		int len = snprintf(req, sizeof(req), "%d.%d", id, i);
+		bool ok = write(fd, req, len) == len && read(fd, rsp, sizeof(rsp)) == len && memcmp(req, rsp, len) == 0;
+		co_pool_return(g_pool, fd, ok);
+	}
+	g_done++;
+	return NULL;
+}
+
+static void PrintStat(const char* when)
+{
+	stCoPoolStat_t stat;
+	co_pool_get_stat(g_pool, &stat);
+	printf("%s: idle %d busy %d, connects %llu reuses %llu evicted %llu broken %llu\n", when,
+		stat.iIdle, stat.iBusy, stat.ullConnects, stat.ullReuses, stat.ullEvicted, stat.ullBroken);
+}
+
+static void* Main(void* args)
+{
+	co_enable_hook_sys();
+	while (g_done < eClients)
+	{
+		poll(NULL, 0, 10);
+	}
+	PrintStat("after rpcs");
+
+	poll(NULL, 0, 800); //past idle_timeout_ms
+	PrintStat("after idle");
+
+	g_generation++;
+	poll(NULL, 0, 500);
+	PrintStat("after server restart");
+	co_pool_free(g_pool);
+	exit(0);
+	return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&g_addr, 0, sizeof(g_addr));
+	g_addr.sin_family = AF_INET;
+	g_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	if (bind(listen_fd, (struct sockaddr*)&g_addr, sizeof(g_addr)) < 0 || listen(listen_fd, 128) < 0)
+	{
+		printf("listen: %s\n", strerror(errno));
+		return -1;
+	}
+	socklen_t len = sizeof(g_addr);
+	getsockname(listen_fd, (struct sockaddr*)&g_addr, &len);
+
+	stCoPoolAttr_t attr;
+	attr.max_per_dest = 4;
+	attr.min_idle_per_dest = 2;
+	attr.idle_timeout_ms = 500;
+	attr.check_interval_ms = 100;
+	g_pool = co_pool_alloc(&attr);
+
+	stCoRoutine_t* co;
+	co_create(&co, NULL, Accept, &listen_fd);
+	co_resume(co);
+
+	int ids[eClients];
+	for (int i = 0; i < eClients; i++)
+	{
+		ids[i] = i;
+		co_create(&co, NULL, Client, ids + i);
+		co_resume(co);
+	}
+	co_create(&co, NULL, Main, NULL);
+	co_resume(co);
+
+	co_eventloop(co_get_epoll_ct(), NULL, NULL);
+	return 0;
+}
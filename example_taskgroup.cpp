@@ -0,0 +1,83 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); 
+* you may not use this file except in compliance with the License. 
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, 
+* software distributed under the License is distributed on an "AS IS" BASIS, 
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. 
+* See the License for the specific language governing permissions and 
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+struct stBackend_t
+{
+	int id;
+	int cost_ms;
+};
+static stShareStack_t *g_share_stack = NULL;
+
+void* Backend(void* args)
+{
+	co_enable_hook_sys();
+	stBackend_t* backend = (stBackend_t*)args;
+	poll(NULL, 0, backend->cost_ms);
+	return (void*)(long)(backend->id * 100);
+}
+void* Handler(void* args)
+{
+	co_enable_hook_sys();
+	int id = 0;
+	stBackend_t backends[10];
+	while (true)
+	{
+		stCoRoutineAttr_t attr;
+		attr.share_stack = g_share_stack;
+		stCoTaskGroup_t* group = co_group_alloc(&attr);
+		for (int i = 0; i < 10; i++)
+		{
+			backends[i].id = i;
+			backends[i].cost_ms = 10 + rand() % 500;
+			co_group_spawn(group, Backend, backends + i);
+		}
+		//quorum of 6 within 300ms
+		int done = co_group_wait(group, 6, 300);
+		printf("%s:%d request %d quorum %s, %d backends done\n", __func__, __LINE__,
+				id++, done >= 6 ? "ok" : strerror(errno), done);
+		for (int i = 0; i < 10; i++)
+		{
+			void* result = NULL;
+			if (0 == co_group_result(group, i, &result))
+			{
+				printf("\tbackend %d result %ld\n", i, (long)result);
+			}
+		}
+		//outstanding backends are detached here
+		co_group_free(group);
+		poll(NULL, 0, 1000);
+	}
+	return NULL;
+}
+int main()
+{
+	g_share_stack = co_alloc_sharestack(16, 1024 * 128);
+
+	stCoRoutine_t* handler;
+	co_create(&handler, NULL, Handler, NULL);
+	co_resume(handler);
+
+	co_eventloop(co_get_epoll_ct(), NULL, NULL);
+	return 0;
+}
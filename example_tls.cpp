@@ -0,0 +1,237 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include "co_tls.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/x509.h>
+
+//tls echo over loopback with a self-signed certificate made at startup.
+//each client connects a few times: the first handshake is a full one,
+//the rest resume from the loop's session cache. the last request gets
+//no answer and runs into the client's SO_RCVTIMEO.
+
+enum
+{
+	eClients = 4,
+	eRounds = 3,
+};
+static SSL_CTX* g_server_ctx = NULL;
+static SSL_CTX* g_client_ctx = NULL;
+static struct sockaddr_in g_addr;
+static int g_done = 0;
+
+static bool MakeCert(EVP_PKEY** pkey, X509** cert)
+{
+	EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+	*pkey = NULL;
+	if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0 || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) <= 0 || EVP_PKEY_keygen(kctx, pkey) <= 0)
+	{
+		EVP_PKEY_CTX_free(kctx);
+		return false;
+	}
+	EVP_PKEY_CTX_free(kctx);
+
+	X509* x = X509_new();
+	X509_set_version(x, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(x), 1);
+	X509_gmtime_adj(X509_getm_notBefore(x), -60);
+	X509_gmtime_adj(X509_getm_notAfter(x), 24 * 3600);
+	X509_set_pubkey(x, *pkey);
+	X509_NAME* name = X509_get_subject_name(x);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+	X509_set_issuer_name(x, name);
+	if (!X509_sign(x, *pkey, EVP_sha256()))
+	{
+		X509_free(x);
+		return false;
+	}
+	*cert = x;
+	return true;
+}
+
+static void* Session(void* args)
+{
+	co_enable_hook_sys();
+	int fd = (int)(long)args;
+	stCoTls_t* tls = co_tls_alloc(g_server_ctx, fd, true);
+	if (co_tls_handshake(tls) == 0)
+	{
+		char buf[1024];
+		ssize_t n;
+		while ((n = co_tls_read(tls, buf, sizeof(buf))) > 0)
+		{
+			if (n >= 4 && memcmp(buf, "slow", 4) == 0)
+			{
+				continue; //never answered
+			}
+			co_tls_write(tls, buf, n);
+		}
+		co_tls_shutdown(tls);
+	}
+	else
+	{
+		printf("server: handshake: %s\n", strerror(errno));
+	}
+	co_tls_free(tls);
+	close(fd);
+	return NULL;
+}
+
+static void* Accept(void* args)
+{
+	co_enable_hook_sys();
+	int listen_fd = *(int*)args;
+	for (;;)
+	{
+		struct pollfd pf = { listen_fd, POLLIN, 0 };
+		if (poll(&pf, 1, 1000) <= 0)
+		{
+			continue; //listen_fd blocks,accept only when it is ready
+		}
+		//nonblocking underneath,the hooked read/write do the waiting
+		int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0)
+		{
+			continue;
+		}
+		alloc_by_fd(fd);
+		stCoRoutine_t* co;
+		co_create(&co, NULL, Session, (void*)(long)fd);
+		co_resume(co);
+	}
+	return NULL;
+}
+
+static void* Client(void* args)
+{
+	co_enable_hook_sys();
+	int id = *(int*)args;
+	for (int i = 0; i <= eRounds; i++)
+	{
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct timeval tv = { 0, 200 * 1000 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		if (connect(fd, (struct sockaddr*)&g_addr, sizeof(g_addr)) < 0)
+		{
+			printf("client %d: connect: %s\n", id, strerror(errno));
+			close(fd);
+			break;
+		}
+		stCoTls_t* tls = co_tls_alloc(g_client_ctx, fd, false);
+		co_tls_set_hostname(tls, "localhost");
+		if (co_tls_handshake(tls) < 0)
+		{
+			printf("client %d: handshake: %s\n", id, strerror(errno));
+			ERR_print_errors_fp(stdout);
+			co_tls_free(tls);
+			close(fd);
+			break;
+		}
+		bool reused = SSL_session_reused(co_tls_ssl(tls));
+
+		char req[64], rsp[64];
+		int len = snprintf(req, sizeof(req), i < eRounds ? "hello %d.%d" : "slow %d.%d", id, i);
+		co_tls_write(tls, req, len);
+		ssize_t n = co_tls_read(tls, rsp, sizeof(rsp) - 1);
+		if (n > 0)
+		{
+			rsp[n] = 0;
+			printf("client %d: %s handshake, echo \"%s\"\n", id, reused ? "resumed" : "full", rsp);
+		}
+		else
+		{
+			printf("client %d: %s handshake, read: %s\n", id, reused ? "resumed" : "full", n < 0 ? strerror(errno) : "eof");
+		}
+		co_tls_shutdown(tls);
+		co_tls_free(tls);
+		close(fd);
+	}
+	g_done++;
+	return NULL;
+}
+
+static void* Main(void* args)
+{
+	co_enable_hook_sys();
+	while (g_done < eClients)
+	{
+		poll(NULL, 0, 10);
+	}
+	exit(0);
+	return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+	EVP_PKEY* pkey = NULL;
+	X509* cert = NULL;
+	if (!MakeCert(&pkey, &cert))
+	{
+		ERR_print_errors_fp(stdout);
+		return -1;
+	}
+	g_server_ctx = SSL_CTX_new(TLS_server_method());
+	SSL_CTX_use_certificate(g_server_ctx, cert);
+	SSL_CTX_use_PrivateKey(g_server_ctx, pkey);
+
+	g_client_ctx = SSL_CTX_new(TLS_client_method());
+	X509_STORE_add_cert(SSL_CTX_get_cert_store(g_client_ctx), cert);
+	SSL_CTX_set_verify(g_client_ctx, SSL_VERIFY_PEER, NULL);
+
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&g_addr, 0, sizeof(g_addr));
+	g_addr.sin_family = AF_INET;
+	g_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	if (bind(listen_fd, (struct sockaddr*)&g_addr, sizeof(g_addr)) < 0 || listen(listen_fd, 128) < 0)
+	{
+		printf("listen: %s\n", strerror(errno));
+		return -1;
+	}
+	socklen_t len = sizeof(g_addr);
+	getsockname(listen_fd, (struct sockaddr*)&g_addr, &len);
+
+	stCoRoutine_t* co;
+	co_create(&co, NULL, Accept, &listen_fd);
+	co_resume(co);
+
+	int ids[eClients];
+	for (int i = 0; i < eClients; i++)
+	{
+		ids[i] = i;
+		co_create(&co, NULL, Client, ids + i);
+		co_resume(co);
+	}
+	co_create(&co, NULL, Main, NULL);
+	co_resume(co);
+
+	co_eventloop(co_get_epoll_ct(), NULL, NULL);
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+//loopback datagram benchmark:
+//	./example_udpbatch single	sendto/recvfrom,one packet per call
+//	./example_udpbatch batch	co_udp_send_batch/co_udp_recv_batch
+//	./example_udpbatch gso		co_udp_send_gso/co_udp_recv_batch with GRO
+//an optional second argument is the packet size,64 by default,e.g.
+//	./example_udpbatch gso 1400	a burst is more than one 64k gso send
+
+enum
+{
+	eMaxPacketSize = 1472,
+	eBatch = 64,
+	eRounds = 16, //batches per 1ms tick
+	eSeconds = 3,
+};
+static const char *g_mode = "batch";
+static int g_packet_size = 64;
+static struct sockaddr_in g_addr;
+static long long g_sent = 0;
+static long long g_recv = 0;
+static bool g_stop = false;
+
+static unsigned long long GetNowMs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+}
+
+static void* Receiver(void* args)
+{
+	co_enable_hook_sys();
+	int fd = *(int*)args;
+	if (strcmp(g_mode, "gso") == 0 && co_udp_enable_gro(fd) < 0)
+	{
+		printf("UDP_GRO not supported: %s\n", strerror(errno));
+	}
+	static char bufs[eBatch][65536]; //room for a GRO datagram
+	stCoDatagram_t dgrams[eBatch];
+	while (!g_stop)
+	{
+		if (strcmp(g_mode, "single") == 0)
+		{
+			if (recvfrom(fd, bufs[0], sizeof(bufs[0]), 0, NULL, NULL) > 0)
+			{
+				g_recv++;
+			}
+			continue;
+		}
+		for (int i = 0; i < eBatch; i++)
+		{
+			dgrams[i].buf = bufs[i];
+			dgrams[i].len = sizeof(bufs[i]);
+		}
+		int n = co_udp_recv_batch(fd, dgrams, eBatch, 100);
+		for (int i = 0; i < n; i++)
+		{
+			//a GRO datagram carries len / segsize packets
+			g_recv += dgrams[i].segsize ? ( dgrams[i].len + dgrams[i].segsize - 1 ) / dgrams[i].segsize : 1;
+		}
+	}
+	return NULL;
+}
+static void* Sender(void* args)
+{
+	co_enable_hook_sys();
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	connect(fd, (struct sockaddr*)&g_addr, sizeof(g_addr));
+
+	static char buf[eMaxPacketSize * eBatch];
+	memset(buf, 'x', sizeof(buf));
+	size_t len = (size_t)g_packet_size * eBatch;
+	stCoDatagram_t dgrams[eBatch];
+	for (int i = 0; i < eBatch; i++)
+	{
+		dgrams[i].buf = buf + i * g_packet_size;
+		dgrams[i].len = g_packet_size;
+		dgrams[i].addrlen = 0;
+	}
+	while (!g_stop)
+	{
+		//a burst per tick,loopback drops what overflows the rcvbuf
+		for (int round = 0; round < eRounds; round++)
+		{
+			if (strcmp(g_mode, "single") == 0)
+			{
+				for (int i = 0; i < eBatch; i++)
+				{
+					g_sent += send(fd, buf, g_packet_size, 0) > 0 ? 1 : 0;
+				}
+			}
+			else if (strcmp(g_mode, "gso") == 0)
+			{
+				int n = co_udp_send_gso(fd, buf, len, g_packet_size, NULL, 0);
+				g_sent += n > 0 ? ( n + g_packet_size - 1 ) / g_packet_size : 0;
+			}
+			else
+			{
+				int n = co_udp_send_batch(fd, dgrams, eBatch, 100);
+				g_sent += n > 0 ? n : 0;
+			}
+		}
+		poll(NULL, 0, 1);
+	}
+	close(fd);
+	return NULL;
+}
+static int TickFunc(void* args)
+{
+	static unsigned long long start = GetNowMs();
+	if (GetNowMs() - start < eSeconds * 1000ULL)
+	{
+		return 0;
+	}
+	g_stop = true;
+	printf("%s %d: sent %lld recv %lld, %.0f packets/s received\n",
+			g_mode, g_packet_size, g_sent, g_recv, g_recv / (double)eSeconds);
+	return -1;
+}
+int main(int argc, char* argv[])
+{
+	if (argc > 1)
+	{
+		g_mode = argv[1];
+	}
+	if (argc > 2)
+	{
+		g_packet_size = atoi(argv[2]);
+		if (g_packet_size <= 0 || g_packet_size > eMaxPacketSize)
+		{
+			printf("packet size 1..%d\n", (int)eMaxPacketSize);
+			return -1;
+		}
+	}
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&g_addr, 0, sizeof(g_addr));
+	g_addr.sin_family = AF_INET;
+	g_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	if (bind(fd, (struct sockaddr*)&g_addr, sizeof(g_addr)) < 0)
+	{
+		printf("bind: %s\n", strerror(errno));
+		return -1;
+	}
+	socklen_t len = sizeof(g_addr);
+	getsockname(fd, (struct sockaddr*)&g_addr, &len);
+	int rcvbuf = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	//the hooked recvfrom needs libco to know the fd
+	alloc_by_fd(fd);
+
+	stCoRoutine_t* receiver;
+	co_create(&receiver, NULL, Receiver, &fd);
+	co_resume(receiver);
+
+	stCoRoutine_t* sender;
+	co_create(&sender, NULL, Sender, NULL);
+	co_resume(sender);
+
+	co_eventloop(co_get_epoll_ct(), TickFunc, NULL);
+	return 0;
+}
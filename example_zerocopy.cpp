@@ -0,0 +1,140 @@
+/*
+* Tencent is pleased to support the open source community by making Libco available.
+
+* Copyright (C) 2014 THL A29 Limited, a Tencent company. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*	http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include "co_routine.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+//MSG_ZEROCOPY sends over loopback ( the kernel copies there,the api is the same ):
+//a reader that drains everything takes sync and async sends,then a reader that
+//never reads leaves the pages pinned and the routine deadline ends the wait.
+
+enum
+{
+	eBufSize = 256 * 1024,
+	eSends = 4,
+};
+static struct sockaddr_in g_addr;
+static char* g_buf = NULL;
+static int g_async_done = 0;
+
+static void* Reader(void* args)
+{
+	co_enable_hook_sys();
+	int fd = (int)(long)args;
+	char buf[64 * 1024];
+	long total = 0;
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+	{
+		total += n;
+	}
+	printf("reader: %ld bytes\n", total);
+	close(fd);
+	return NULL;
+}
+
+static int Connect()
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (connect(fd, (struct sockaddr*)&g_addr, sizeof(g_addr)) < 0)
+	{
+		printf("connect: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	if (co_zerocopy_enable(fd) < 0)
+	{
+		printf("SO_ZEROCOPY not supported: %s\n", strerror(errno));
+	}
+	return fd;
+}
+
+static void OnAsyncDone(const void* buf, size_t len, void* arg)
+{
+	g_async_done++;
+}
+
+static void* Main(void* args)
+{
+	co_enable_hook_sys();
+	int listen_fd = *(int*)args;
+
+	int fd = Connect();
+	int peer = accept(listen_fd, NULL, NULL);
+	alloc_by_fd(peer);
+	stCoRoutine_t* co;
+	co_create(&co, NULL, Reader, (void*)(long)peer);
+	co_resume(co);
+	for (int i = 0; i < eSends; i++)
+	{
+		printf("send: %zd\n", co_zerocopy_send(fd, g_buf, eBufSize, 0));
+	}
+	for (int i = 0; i < eSends; i++)
+	{
+		printf("send_async: %zd\n", co_zerocopy_send_async(fd, g_buf, eBufSize, 0, OnAsyncDone, NULL));
+	}
+	printf("release: %d, %d async done\n", co_zerocopy_release(fd, 1000), g_async_done);
+	close(fd);
+
+	//nobody reads: the pinned pages never come back,the deadline ends the wait
+	fd = Connect();
+	int idle = accept(listen_fd, NULL, NULL);
+	co_set_deadline(200);
+	ssize_t ret = co_zerocopy_send(fd, g_buf, eBufSize, 0);
+	printf("send past deadline: %zd %s\n", ret, strerror(errno));
+	int rel = co_zerocopy_release(fd, -1);
+	printf("release past deadline: %d %s\n", rel, strerror(errno));
+	co_set_deadline(-1);
+	close(idle); //the peer drops the data,the reaper finishes the request
+	co_zerocopy_release(fd, 1000);
+	close(fd);
+	exit(0);
+	return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+	g_buf = (char*)malloc(eBufSize);
+	memset(g_buf, 'x', eBufSize);
+
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&g_addr, 0, sizeof(g_addr));
+	g_addr.sin_family = AF_INET;
+	g_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	if (bind(listen_fd, (struct sockaddr*)&g_addr, sizeof(g_addr)) < 0 || listen(listen_fd, 128) < 0)
+	{
+		printf("listen: %s\n", strerror(errno));
+		return -1;
+	}
+	socklen_t len = sizeof(g_addr);
+	getsockname(listen_fd, (struct sockaddr*)&g_addr, &len);
+
+	stCoRoutine_t* co;
+	co_create(&co, NULL, Main, &listen_fd);
+	co_resume(co);
+
+	co_eventloop(co_get_epoll_ct(), NULL, NULL);
+	return 0;
+}